@@ -148,6 +148,9 @@ typedef struct
 
   uint8_t   doublebuffer;    /*!< Double buffer enable
                                  This parameter can be 0 or 1                                             */    
+
+  uint8_t   db_filled;      /*!< Double buffered IN: next packet already written to the application buffer
+                                 This parameter can be 0 or 1                                             */
                                 
   uint32_t  maxpacket;      /*!< Endpoint Max packet size
                                  This parameter must be a number between Min_Data = 0 and Max_Data = 64KB */
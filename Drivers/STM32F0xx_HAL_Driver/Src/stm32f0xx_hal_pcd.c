@@ -103,6 +103,7 @@
   * @{
   */
 static HAL_StatusTypeDef PCD_EP_ISR_Handler(PCD_HandleTypeDef *hpcd);
+static void PCD_EP_DB_WritePacket(PCD_HandleTypeDef *hpcd, PCD_EPTypeDef *ep);
 void PCD_WritePMA(USB_TypeDef  *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes);
 void PCD_ReadPMA(USB_TypeDef  *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes);
 /**
@@ -735,10 +736,11 @@ HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint
     }
     else
     {
-      /* Clear the data toggle bits for the endpoint IN/OUT*/
+      /* Clear the data toggle bits for the endpoint IN/OUT: SW_BUF == DTOG_TX,
+         nothing queued, the application owns buffer 0 */
       PCD_CLEAR_RX_DTOG(hpcd->Instance, ep->num)
       PCD_CLEAR_TX_DTOG(hpcd->Instance, ep->num)
-      PCD_RX_DTOG(hpcd->Instance, ep->num);
+      ep->db_filled = 0U;
       /* Configure DISABLE status for the Endpoint*/
       PCD_SET_EP_TX_STATUS(hpcd->Instance, ep->num, USB_EP_TX_DIS)
       PCD_SET_EP_RX_STATUS(hpcd->Instance, ep->num, USB_EP_RX_DIS)
@@ -806,10 +808,11 @@ HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
     }
     else
     {
-      /* Clear the data toggle bits for the endpoint IN/OUT*/
+      /* Clear the data toggle bits for the endpoint IN/OUT: SW_BUF == DTOG_TX,
+         nothing queued, the application owns buffer 0 */
       PCD_CLEAR_RX_DTOG(hpcd->Instance, ep->num)
       PCD_CLEAR_TX_DTOG(hpcd->Instance, ep->num)
-      PCD_RX_DTOG(hpcd->Instance, ep->num);
+      ep->db_filled = 0U;
       /* Configure DISABLE status for the Endpoint*/
       PCD_SET_EP_TX_STATUS(hpcd->Instance, ep->num, USB_EP_TX_DIS)
       PCD_SET_EP_RX_STATUS(hpcd->Instance, ep->num, USB_EP_RX_DIS)
@@ -893,7 +896,6 @@ uint16_t HAL_PCD_EP_GetRxCount(PCD_HandleTypeDef *hpcd, uint8_t ep_addr)
 HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len)
 {
   PCD_EPTypeDef *ep;
-  uint16_t pmabuffer = 0U;
     
   ep = &hpcd->IN_ep[ep_addr & 0x7FU];
   
@@ -904,42 +906,36 @@ HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef *hpcd, uint8_t ep_addr,
   ep->is_in = 1U;
   ep->num = ep_addr & 0x7FU;
   
-  /*Multi packet transfer*/
-  if (ep->xfer_len > ep->maxpacket)
-  {
-    len=ep->maxpacket;
-    ep->xfer_len-=len; 
-  }
-  else
-  {  
-    len=ep->xfer_len;
-    ep->xfer_len =0U;
-  }
-  
   /* configure and validate Tx endpoint */
   if (ep->doublebuffer == 0U) 
   {
+    /*Multi packet transfer*/
+    if (ep->xfer_len > ep->maxpacket)
+    {
+      len=ep->maxpacket;
+      ep->xfer_len-=len; 
+    }
+    else
+    {  
+      len=ep->xfer_len;
+      ep->xfer_len =0U;
+    }
+  
     PCD_WritePMA(hpcd->Instance, ep->xfer_buff, ep->pmaadress, len);
     PCD_SET_EP_TX_CNT(hpcd->Instance, ep->num, len);
   }
   else
   {
-    /*Write the data to the USB endpoint*/
-    if ((PCD_GET_ENDPOINT(hpcd->Instance, ep->num)& USB_EP_DTOG_TX) == USB_EP_DTOG_TX)
-    {
-      /*Set the Double buffer counter for pmabuffer1*/
-      PCD_SET_EP_DBUF1_CNT(hpcd->Instance, ep->num, ep->is_in, len)
-      pmabuffer = ep->pmaaddr1;
-    }
-    else
+    /* Hand the first packet to the USB, then prefill the other buffer so that
+       the next packet only needs a SW_BUF toggle on CTR_TX */
+    PCD_EP_DB_WritePacket(hpcd, ep);
+    PCD_FreeUserBuffer(hpcd->Instance, ep->num, PCD_EP_DBUF_IN)
+    ep->db_filled = 0U;
+    if (ep->xfer_len != 0U)
     {
-      /*Set the Double buffer counter for pmabuffer0*/
-      PCD_SET_EP_DBUF0_CNT(hpcd->Instance, ep->num, ep->is_in, len)
-      pmabuffer = ep->pmaaddr0;
+      PCD_EP_DB_WritePacket(hpcd, ep);
+      ep->db_filled = 1U;
     }
-
-    PCD_WritePMA(hpcd->Instance, ep->xfer_buff, pmabuffer, len);
-    PCD_FreeUserBuffer(hpcd->Instance, ep->num, ep->is_in)
   }
 
   PCD_SET_EP_TX_STATUS(hpcd->Instance, ep->num, USB_EP_TX_VALID)
@@ -1344,48 +1340,69 @@ static HAL_StatusTypeDef PCD_EP_ISR_Handler(PCD_HandleTypeDef *hpcd)
           {
             PCD_WritePMA(hpcd->Instance, ep->xfer_buff, ep->pmaadress, ep->xfer_count);
           }
-        }
-        else
-        {
-          if ((PCD_GET_ENDPOINT(hpcd->Instance, ep->num)& USB_EP_DTOG_TX) == USB_EP_DTOG_TX)
+          /*multi-packet on the NON control IN endpoint*/
+          ep->xfer_count = PCD_GET_EP_TX_CNT(hpcd->Instance, ep->num);
+          ep->xfer_buff+=ep->xfer_count;
+         
+          /* Zero Length Packet? */
+          if (ep->xfer_len == 0U)
           {
-            /*read from endpoint BUF0Addr buffer*/
-            ep->xfer_count = PCD_GET_EP_DBUF0_CNT(hpcd->Instance, ep->num);
-            if (ep->xfer_count != 0U)
-            {
-              PCD_WritePMA(hpcd->Instance, ep->xfer_buff, ep->pmaaddr0, ep->xfer_count);
-            }
+            /* TX COMPLETE */
+            HAL_PCD_DataInStageCallback(hpcd, ep->num);
           }
           else
           {
-            /*read from endpoint BUF1Addr buffer*/
-            ep->xfer_count = PCD_GET_EP_DBUF1_CNT(hpcd->Instance, ep->num);
-            if (ep->xfer_count != 0U)
-            {
-              PCD_WritePMA(hpcd->Instance, ep->xfer_buff, ep->pmaaddr1, ep->xfer_count);
-            }
+            HAL_PCD_EP_Transmit(hpcd, ep->num, ep->xfer_buff, ep->xfer_len);
           }
-          PCD_FreeUserBuffer(hpcd->Instance, ep->num, PCD_EP_DBUF_IN) 
         }
-        /*multi-packet on the NON control IN endpoint*/
-        ep->xfer_count = PCD_GET_EP_TX_CNT(hpcd->Instance, ep->num);
-        ep->xfer_buff+=ep->xfer_count;
-       
-        /* Zero Length Packet? */
-        if (ep->xfer_len == 0U)
+        else if (ep->db_filled != 0U)
         {
-          /* TX COMPLETE */
-          HAL_PCD_DataInStageCallback(hpcd, ep->num);
+          /* Next packet already in the PMA: release it, then refill the
+             buffer the USB just sent from */
+          PCD_FreeUserBuffer(hpcd->Instance, ep->num, PCD_EP_DBUF_IN)
+          ep->db_filled = 0U;
+          if (ep->xfer_len != 0U)
+          {
+            PCD_EP_DB_WritePacket(hpcd, ep);
+            ep->db_filled = 1U;
+          }
         }
         else
         {
-          HAL_PCD_EP_Transmit(hpcd, ep->num, ep->xfer_buff, ep->xfer_len);
+          /* TX COMPLETE */
+          HAL_PCD_DataInStageCallback(hpcd, ep->num);
         }
       } 
     }
   }
   return HAL_OK;
 }
+
+/**
+  * @brief  Copy the next packet of a double buffered IN transfer to the
+  *         buffer the application owns (the one SW_BUF points to)
+  * @param  hpcd PCD handle
+  * @param  ep endpoint structure
+  * @retval None
+  */
+static void PCD_EP_DB_WritePacket(PCD_HandleTypeDef *hpcd, PCD_EPTypeDef *ep)
+{
+  uint32_t len = (ep->xfer_len > ep->maxpacket) ? ep->maxpacket : ep->xfer_len;
+
+  if ((PCD_GET_ENDPOINT(hpcd->Instance, ep->num) & USB_EP_DTOG_RX) == USB_EP_DTOG_RX)
+  {
+    PCD_SET_EP_DBUF1_CNT(hpcd->Instance, ep->num, PCD_EP_DBUF_IN, len)
+    PCD_WritePMA(hpcd->Instance, ep->xfer_buff, ep->pmaaddr1, len);
+  }
+  else
+  {
+    PCD_SET_EP_DBUF0_CNT(hpcd->Instance, ep->num, PCD_EP_DBUF_IN, len)
+    PCD_WritePMA(hpcd->Instance, ep->xfer_buff, ep->pmaaddr0, len);
+  }
+  ep->xfer_buff += len;
+  ep->xfer_len -= len;
+  ep->xfer_count += len;
+}
 /**
   * @}
   */
@@ -0,0 +1,46 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "thOutput.h"
+
+/* Sample log: a ring of flash pages right below the config (62) and BSEC state (63) pages.
+   Set by the Makefile, which passes it to STM32F072CBUx_FLASH.ld too: the FLASH region
+   ends at LOG_FIRST_PAGE */
+#ifndef LOG_PAGES
+#define LOG_PAGES			4
+#endif
+#define LOG_FIRST_PAGE		(62 - LOG_PAGES)
+
+/* Shortest thConfig.logPeriod (s). 4 pages hold 204 to 272 records: 2.1 to 2.8 days every
+   15 minutes, 8.5 to 11 days every hour. Each page is erased every ~17 hours at most, ~19 years
+   of the 10k cycles flash endurance */
+#define LOG_PERIOD_MIN		900
+
+void flashLogInit(void);
+void flashLogAdd(const sample_t *sample);
+bool flashLogGet(uint32_t index, sample_t *sample);
+uint32_t flashLogFirst(void);
+uint32_t flashLogLast(void);
@@ -0,0 +1,67 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#define JSMN_HEADER		/* the token types only, nothing runs jsmn_parse() */
+#include "jsmn.h"
+
+/* Incremental JSON object reader for the shell commands, fed one byte at a time as the
+   packets come in. The members of the top-level object come out one by one, as jsmn would
+   have tokenized them: tokens[0] the key, tokens[1] its value, then the value's children.
+   Only a member has to fit, not the whole object. The member storage is shared by the
+   streams: one starting a member while another is in the middle of one takes it, the
+   interrupted member fails */
+#define JSON_MEMBER_MAX		192		/* bytes of a member, key and value, whitespace left out */
+#define JSON_MEMBER_TOKENS	20
+#define JSON_MEMBER_DEPTH	4		/* nested arrays/objects in a value */
+
+/* jsonStreamPut() events, a '}' can end a member and the object at once */
+#define JSON_STREAM_MEMBER	0x01	/* buf/tokens hold a member until the next byte */
+#define JSON_STREAM_END		0x02	/* the top-level object is closed */
+#define JSON_STREAM_ERROR	0x04	/* bad syntax or a member too long, skipping to the end of the line */
+
+typedef struct jsonStream jsonStream_t;
+
+typedef struct {
+	char		buf[JSON_MEMBER_MAX + 1];	/* the token offsets point here, '\0' terminated */
+	jsmntok_t	tokens[JSON_MEMBER_TOKENS];
+	const jsonStream_t *owner;				/* the stream reading into it */
+	uint8_t		count;						/* tokens in use */
+	uint8_t		len;						/* of buf */
+	uint8_t		depth;						/* containers open in the value */
+	uint8_t		open[JSON_MEMBER_DEPTH];	/* their tokens */
+	bool		key;						/* a key comes next in the innermost object */
+	bool		sep;						/* a token is done in the innermost container: ',', ':' or its end next */
+	bool		escape;						/* after a '\' in a string */
+} jsonMember_t;
+
+struct jsonStream {
+	jsonMember_t *member;					/* set once, the other fields start zeroed */
+	uint8_t		state;
+};
+
+void jsonStreamResync(jsonStream_t *js);
+uint8_t jsonStreamPut(jsonStream_t *js, char c);
+bool jsonStreamIdle(const jsonStream_t *js);
@@ -67,6 +67,7 @@ void HardFault_Handler(void);
 void SVC_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
+void RTC_IRQHandler(void);
 void TIM2_IRQHandler(void);
 void USB_IRQHandler(void);
 /* USER CODE BEGIN EFP */
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+
 /* Use the following bme680 driver: https://github.com/BoschSensortec/BME680_driver/releases/tag/bme680_v3.5.1 */
 #include "bme680.h"
 #include "bsec_interface.h"
@@ -27,6 +29,16 @@ typedef uint32_t (*config_load_fct)(uint8_t *state_buffer, uint32_t n_buffer);
     
 /* structure definitions */
 
+/* BSEC state transfer (calibration export/import), see bsec_iot_state_export() */
+typedef enum {
+    STATE_XFER_IDLE = 0,        /* nothing asked yet, or import chunks coming in */
+    STATE_XFER_EXPORT,          /* snapshot asked, taken by the BSEC loop before its next sample */
+    STATE_XFER_IMPORT,          /* import asked, applied by the BSEC loop before its next sample */
+    STATE_XFER_EXPORTED,        /* snapshot in the transfer buffer */
+    STATE_XFER_IMPORTED,        /* state applied and saved in flash */
+    STATE_XFER_FAILED           /* CRC mismatch, or the state was refused by BSEC */
+} stateXfer_t;
+
 /* Structure with the return value from bsec_iot_init() */
 typedef struct{
 	/*! Result of API execution status */
@@ -64,3 +76,62 @@ return_values_init bsec_iot_init(float sample_rate, float temperature_offset, bm
  */ 
 void bsec_iot_loop(sleep_fct sleep, get_timestamp_us_fct get_timestamp_us, output_ready_fct output_ready,
     state_save_fct state_save, uint32_t save_intvl);
+
+/*!
+ * @brief       Asks for one more sample as soon as BSEC allows it (ULP plus), ignored in LP
+ *
+ * @return      none
+ */
+void bsec_iot_measure(void);
+
+/*!
+ * @brief       Asks for a snapshot of the BSEC state (bsec_get_state()) in the transfer buffer.
+ *              The BSEC loop takes it between two samples, then the status is STATE_XFER_EXPORTED
+ *
+ * @return      none
+ */
+void bsec_iot_state_export(void);
+
+/*!
+ * @brief       Asks for the state in the transfer buffer to be applied (bsec_set_state()) and saved in
+ *              flash, between two samples. Checked against the CRC there: STATE_XFER_FAILED on a mismatch
+ *
+ * @param[in]   len                 state length, the chunks written with bsec_iot_state_write()
+ * @param[in]   crc                 CRC16 of the state (thOutput.c)
+ *
+ * @return      false if the length is out of range
+ */
+bool bsec_iot_state_import(uint16_t len, uint16_t crc);
+
+/*!
+ * @brief       Copies a chunk of the exported state, zero filled past its end
+ *
+ * @param[in]   offset              from the start of the state
+ * @param[out]  dst                 chunk
+ * @param[in]   len                 chunk length
+ *
+ * @return      none
+ */
+void bsec_iot_state_read(uint16_t offset, uint8_t *dst, uint16_t len);
+
+/*!
+ * @brief       Writes a chunk of the state to import into the transfer buffer, the part past
+ *              BSEC_MAX_STATE_BLOB_SIZE is dropped. A previous export is lost
+ *
+ * @param[in]   offset              from the start of the state
+ * @param[in]   src                 chunk
+ * @param[in]   len                 chunk length
+ *
+ * @return      none
+ */
+void bsec_iot_state_write(uint16_t offset, const uint8_t *src, uint16_t len);
+
+/*!
+ * @brief       State transfer status
+ *
+ * @param[out]  len                 state length, 0 unless exported or imported
+ * @param[out]  crc                 its CRC16
+ *
+ * @return      stateXfer_t
+ */
+uint8_t bsec_iot_state_status(uint16_t *len, uint16_t *crc);
@@ -0,0 +1,42 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* USB host time (thClock.c): the start-of-frame packets come every 1 ms from the host
+   controller, the same frame number for every device on it. Each SOF is captured against
+   SysTick, so a sample can be stamped with the last frame number plus the microseconds since */
+#define SOF_TOLERANCE_CYCLES	96		/* accepted SOF capture jitter, 2 us at 48 MHz */
+#define SOF_MAX_AGE_MS			100		/* no SOF reference after that (suspend, unplugged) */
+#define SOF_OFFSET_INVALID		0xFFFF
+
+typedef struct _hostTime_t {
+	uint32_t	frame;			/* USB frame number, the 11 low bits as on the bus, extended by the device */
+	uint16_t	offset;			/* us into the frame, SOF_OFFSET_INVALID if there is no SOF reference */
+} hostTime_t;
+
+void clockSof(void);
+uint64_t clockMicros(void);
+bool clockHostTime(hostTime_t *time);
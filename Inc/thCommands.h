@@ -0,0 +1,87 @@
+/* Generated by tools/cmdhash.py, do not edit: the commands are listed there.
+   Included by thConfig.c only, the handlers are its own */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "jsonStream.h"
+
+typedef enum {
+	VALUE_NONE,		/* no value needed, the key is the command */
+	VALUE_ANY,		/* the handler reads the token */
+	VALUE_BOOL,		/* true or false */
+	VALUE_UINT,		/* decimal, unsigned */
+	VALUE_FLOAT,
+} valueType_t;
+
+typedef struct {
+	const char *json;
+	const jsmntok_t *tok;	/* NULL for a key alone, {"status"}: VALUE_NONE only */
+	union {
+		uint32_t u;
+		float f;
+		bool b;
+	};
+} cmdValue_t;
+
+/* What's next for the object, once the handler is done */
+typedef enum {
+	CMD_NEXT,		/* on with the other keys */
+	CMD_DONE,		/* the reply is sent: no status reply, the other actions are skipped */
+	CMD_SAVE,		/* store thConfig in flash when the object is closed */
+} cmdResult_t;
+
+typedef cmdResult_t (*cmdHandler_t)(const cmdValue_t *value);
+
+typedef struct {
+	const char *key;	/* NULL: free slot */
+	uint8_t len;
+	valueType_t type;
+	bool action;		/* run once the object is closed without error, the settings in place */
+	cmdHandler_t handler;
+} command_t;
+
+#define COMMAND_HASH_SEED	0x00000017UL
+#define COMMAND_TABLE_SIZE	64
+#define COMMAND_HASH_SHIFT	26	/* slot: the top bits of the hash */
+
+static cmdResult_t cmdStatus(const cmdValue_t *value);
+static cmdResult_t cmdInfo(const cmdValue_t *value);
+static cmdResult_t cmdReplay(const cmdValue_t *value);
+static cmdResult_t cmdLogDump(const cmdValue_t *value);
+static cmdResult_t cmdLed(const cmdValue_t *value);
+static cmdResult_t cmdFormat(const cmdValue_t *value);
+static cmdResult_t cmdFields(const cmdValue_t *value);
+static cmdResult_t cmdReportingPeriod(const cmdValue_t *value);
+static cmdResult_t cmdTemperatureOffset(const cmdValue_t *value);
+static cmdResult_t cmdReport(const cmdValue_t *value);
+static cmdResult_t cmdDeadband(const cmdValue_t *value);
+static cmdResult_t cmdStatsLast(const cmdValue_t *value);
+static cmdResult_t cmdLogPeriod(const cmdValue_t *value);
+static cmdResult_t cmdCatchUp(const cmdValue_t *value);
+static cmdResult_t cmdHidInterval(const cmdValue_t *value);
+static cmdResult_t cmdHidSize(const cmdValue_t *value);
+static cmdResult_t cmdSampleRate(const cmdValue_t *value);
+static cmdResult_t cmdMeasure(const cmdValue_t *value);
+static cmdResult_t cmdSaveConfig(const cmdValue_t *value);
+
+static const command_t commandTable[COMMAND_TABLE_SIZE] = {
+	[ 0] = { "report",             6, VALUE_ANY,   false, cmdReport },
+	[21] = { "temperatureOffset", 17, VALUE_FLOAT, false, cmdTemperatureOffset },
+	[22] = { "hidSize",            7, VALUE_UINT,  false, cmdHidSize },
+	[24] = { "deadband",           8, VALUE_ANY,   false, cmdDeadband },
+	[25] = { "catchUp",            7, VALUE_BOOL,  false, cmdCatchUp },
+	[26] = { "logPeriod",          9, VALUE_UINT,  false, cmdLogPeriod },
+	[27] = { "replay",             6, VALUE_UINT,  true,  cmdReplay },
+	[29] = { "sampleRate",        10, VALUE_ANY,   false, cmdSampleRate },
+	[32] = { "status",             6, VALUE_NONE,  true,  cmdStatus },
+	[35] = { "statsLast",          9, VALUE_BOOL,  false, cmdStatsLast },
+	[36] = { "measure",            7, VALUE_NONE,  true,  cmdMeasure },
+	[37] = { "fields",             6, VALUE_ANY,   false, cmdFields },
+	[38] = { "reportingPeriod",   15, VALUE_UINT,  false, cmdReportingPeriod },
+	[41] = { "format",             6, VALUE_ANY,   false, cmdFormat },
+	[42] = { "hidInterval",       11, VALUE_UINT,  false, cmdHidInterval },
+	[49] = { "led",                3, VALUE_BOOL,  false, cmdLed },
+	[53] = { "logDump",            7, VALUE_UINT,  true,  cmdLogDump },
+	[57] = { "info",               4, VALUE_NONE,  true,  cmdInfo },
+	[61] = { "saveConfig",        10, VALUE_NONE,  false, cmdSaveConfig },
+};
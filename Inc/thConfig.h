@@ -29,9 +29,25 @@ typedef enum {
 	JSON 	= 0,
 	HUMAN 	= 1,
 	CSV		= 2,
-	BINARY	= 3
+	BINARY	= 3,
+	CBOR	= 4
 } outFormat_t;
 
+/* What goes out every reporting period */
+typedef enum {
+	REPORT_LAST		= 0,	/* the latest sample */
+	REPORT_STATS	= 1,	/* min/max/mean/sd of the samples in the period (thStats.c) */
+	REPORT_CHANGE	= 2,	/* a sample as soon as a field moves past its deadband, the period is the heartbeat */
+	REPORT_MODES
+} reportMode_t;
+
+/* BSEC sample rate, switched between two samples (thBsec.c) */
+typedef enum {
+	SAMPLE_RATE_LP	= 0,	/* every 3 s */
+	SAMPLE_RATE_ULP	= 1,	/* every 300 s, plus the measurements asked for ("measure") */
+	SAMPLE_RATE_MODES
+} sampleRate_t;
+
 #pragma pack ( 1 ) 
 typedef struct _configs_t {
 	uint8_t		reportingPeriodIdx;
@@ -40,19 +56,33 @@ typedef struct _configs_t {
 	outFormat_t	format;
 	char 		serialNumberStr[17];
 	float		temperatureOffset;	
+	uint16_t	fieldMask;			/* output fields, bit n: field_t n (thOutput.h) */
+	uint16_t	logPeriod;			/* s between flash log records, 0: not logging */
+	uint8_t		reportMode;			/* reportMode_t */
+	bool		statsLast;			/* REPORT_STATS: the last value too */
+	float		deadband[8];		/* REPORT_CHANGE thresholds per field_t, output units, 0: ignored */
+	uint32_t	hidInterval;		/* ms between HID input report bursts, 0: off */
+	uint8_t		hidValueSize;		/* bytes per HID value, 2 or 4, applied at boot (thHid.c) */
+	bool		catchUp;			/* replay the samples missed while the VCP was closed */
+	uint8_t		sampleRate;			/* sampleRate_t */
 } configs_t; 
 
 
-#define SHELL_BUFFER_LENGTH 256
+/* the single character commands, the JSON ones don't go through it (jsonStream.c) */
+#define SHELL_BUFFER_LENGTH 32
 typedef struct shellBuffer_t {
 	char Buf[SHELL_BUFFER_LENGTH];
 	uint8_t idx;
 	bool newLine;
+	bool overflow;		/* line too long, dropped up to its end */
 } shellBuffer_t;
 
 
-void processVCPinput(void);
+void processCommands(void);
 
 int uprintf(const char *format, ...);
+int uwrite(const uint8_t *buf, uint16_t len);
+char *ureserve(uint16_t len);
+void ucommit(uint16_t len);
 
 void initConfig(void);
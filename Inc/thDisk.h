@@ -0,0 +1,45 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+
+/* Read-only FAT12 volume holding one file, LOG.CSV: the flash sample log (flashLog.c)
+   rendered as CSV while the sectors are read. Every line is padded to CSV_LINE_SIZE,
+   so a file offset maps straight to a record. Served by thMsc.c.
+   Layout: boot sector, two copies of the FAT, the root directory, then one sector
+   per cluster, the file from cluster 2 on */
+#define DISK_BLOCK_SIZE		512
+#define DISK_CLUSTERS		256
+#define DISK_FAT_SECTORS	(((DISK_CLUSTERS + 2) * 3 / 2 + DISK_BLOCK_SIZE - 1) / DISK_BLOCK_SIZE)
+#define DISK_ROOT_ENTRIES	16
+#define DISK_FAT_START		1
+#define DISK_ROOT_START		(DISK_FAT_START + 2 * DISK_FAT_SECTORS)
+#define DISK_DATA_START		(DISK_ROOT_START + DISK_ROOT_ENTRIES * 32 / DISK_BLOCK_SIZE)
+#define DISK_BLOCKS			(DISK_DATA_START + DISK_CLUSTERS)
+
+#define CSV_LINE_SIZE		128		/* "\r\n" included, a power of 2 dividing DISK_BLOCK_SIZE */
+#define CSV_LINES_PER_BLOCK	(DISK_BLOCK_SIZE / CSV_LINE_SIZE)
+
+void diskSnapshot(void);
+void diskRead(uint32_t block, uint8_t *dst);
@@ -0,0 +1,49 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* HID Sensor interface (usbd_cdc.c): one application collection per sensor, report ID n is
+   hidSensor[n - 1] in thHid.c. Input reports carry the values, the feature report the report
+   interval (ms). The descriptor length doesn't depend on the value size, it's in the
+   configuration descriptor (HID_REPORT_DESC_SIZ, usbd_cdc.h) */
+#define HID_SENSORS				4
+#define HID_REPORT_DESC_SIZE	225
+#define HID_INPUT_REPORT_MAX	(1 + 2 * 4)
+#define HID_FEATURE_REPORT_SIZE	(1 + 4)
+
+#define HID_REPORT_TYPE_INPUT	0x01
+#define HID_REPORT_TYPE_FEATURE	0x03
+
+#define HID_INTERVAL_MIN		1000	/* ms, the reports go out from the 1 s TIM2 tick */
+#define HID_INTERVAL_MAX		3600000
+
+void hidInit(void);
+void hidTick(void);
+void hidReportSent(void);
+
+uint8_t *hidReportDescriptor(uint16_t *len);
+int8_t hidGetReport(uint8_t type, uint8_t id, uint8_t *dst, uint16_t *len);
+int8_t hidSetReport(uint8_t type, uint8_t id, uint8_t *src, uint16_t len);
@@ -0,0 +1,42 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "thOutput.h"
+
+/* Samples kept in RAM for the replay, PACKED_SAMPLE_SIZE bytes each (~2.5 minutes at 3 s, 4 hours
+   in ULP). Older ones come from the flash log */
+#define HISTORY_LENGTH		48
+
+void historyAdd(const sample_t *sample);
+bool historyGet(uint32_t seq, sample_t *sample);
+uint32_t historyFirstSeq(void);
+uint32_t historyLastSeq(void);
+
+/* vendor: the records go out on the vendor interface (binary frames) instead of the VCP */
+bool historyReplay(uint32_t since, bool vendor);
+bool historyReplayLog(uint32_t since, bool vendor);
+bool historyReplayActive(void);
+void historyService(void);
@@ -0,0 +1,147 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "thConfig.h"
+#include "thClock.h"
+
+/* Record types, first byte of every binary frame payload */
+#define RECORD_TYPE_SAMPLE		0x01	/* all the fields */
+#define RECORD_TYPE_SAMPLE_MASK	0x02	/* field mask (u16) after the timestamp, then the selected fields only */
+#define RECORD_TYPE_STATS		0x03	/* reporting window statistics, see serializeStats() */
+#define RECORD_TYPE_TEXT		0x04	/* command reply text, vendor interface only */
+#define RECORD_TYPE_REQUEST		0x05	/* binary request to the device, see thProto.h */
+#define RECORD_TYPE_RESPONSE	0x06	/* its response, vendor interface only */
+#define RECORD_FLAG_SOF			0x80	/* sample records: USB frame (u32) and offset (u16, us) after the timestamp */
+
+/* Output fields, in output order. Index into fieldTable[] and sample_t.value[] */
+typedef enum {
+	FIELD_TEMPERATURE = 0,
+	FIELD_PRESSURE,
+	FIELD_HUMIDITY,
+	FIELD_GAS_RESISTANCE,
+	FIELD_IAQ,
+	FIELD_IAQ_ACCURACY,
+	FIELD_CO2,
+	FIELD_BREATH_VOC,
+	FIELD_COUNT
+} field_t;
+
+#define FIELD_MASK_ALL		((1 << FIELD_COUNT) - 1)
+
+/* Field descriptor, one row per output field */
+typedef struct _fieldDesc_t {
+	const char	*name;			/* JSON key */
+	const char	*key;			/* CBOR key, short to keep the map small */
+	const char	*label;			/* HUMAN label */
+	const char	*unit;			/* HUMAN unit, "" for none */
+	uint8_t		bsecId;			/* BSEC virtual sensor the value comes from */
+	uint8_t		divisor;		/* text value = value / divisor (Pa -> hPa) */
+	uint8_t		jsonDecimals;
+	uint8_t		textDecimals;	/* CSV and HUMAN */
+	uint8_t		width;			/* minimum text width */
+	uint8_t		humanFlags;		/* fmtFixed() flags for HUMAN */
+	uint8_t		binSize;		/* bytes in the binary record (little endian) */
+	uint8_t		binDecimals;	/* binary value = value * 10^binDecimals */
+} fieldDesc_t;
+
+extern const fieldDesc_t fieldTable[FIELD_COUNT];
+
+/* One BSEC output set, as reported */
+typedef struct _sample_t {
+	uint32_t	seq;			/* sample sequence number */
+	uint32_t	timestamp;		/* ms since boot */
+	hostTime_t	sof;			/* USB host time of the measurement, see thClock.h */
+	uint16_t	fieldMask;		/* fields to output, FIELD_MASK_ALL by default */
+	float		value[FIELD_COUNT];
+} sample_t;
+
+/* Statistics over a reporting window, updated sample by sample (thStats.c) */
+typedef struct _stats_t {
+	uint32_t	seq;			/* window number */
+	uint32_t	from;			/* first sample timestamp (ms) */
+	uint32_t	to;				/* last sample timestamp (ms) */
+	uint32_t	count;			/* samples in the window */
+	uint16_t	fieldMask;
+	float		min[FIELD_COUNT];
+	float		max[FIELD_COUNT];
+	float		mean[FIELD_COUNT];
+	float		m2[FIELD_COUNT];	/* sum of the squared differences from the mean (Welford) */
+	float		last[FIELD_COUNT];
+} stats_t;
+
+/* Binary sample record: type, seq (u32), timestamp (u32), [SOF frame (u32), SOF offset (u16)],
+   [field mask (u16)], then the fields in table order. Upper bound, every field is 4 bytes at most */
+#define SAMPLE_RECORD_MAX_SIZE	(1 + 4 + 4 + 4 + 2 + 2 + FIELD_COUNT * 4)
+
+/* packSample() record: timestamp (u32) and every field as in the binary record,
+   the sum of fieldTable[].binSize. Checked against the table at compile time (thOutput.c) */
+#define PACKED_SAMPLE_SIZE		(4 + 23)
+
+/* payload + CRC16, plus the COBS overhead byte and the 0x00 delimiter */
+#define BINARY_FRAME_MAX_SIZE	(SAMPLE_RECORD_MAX_SIZE + 2 + 2)
+
+/* Scaled integer, value * 10^decimals. negative keeps the sign of a value
+   that rounds to zero, so "-0.00" is rendered the same way printf does */
+typedef struct _fixed_t {
+	int32_t		value;
+	bool		negative;
+} fixed_t;
+
+/* fmtFixed() flags */
+#define FMT_SPACE_SIGN	0x01	/* printf "% f": blank before positive values */
+
+fixed_t toFixed(float value, uint8_t decimals);
+char *fmtFixed(char *dst, fixed_t fixed, uint8_t decimals, uint8_t width, uint8_t flags);
+char *fmtUint(char *dst, uint32_t value);
+char *fmtStr(char *dst, const char *str);
+
+uint16_t serializeSample(const sample_t *sample, outFormat_t format, bool withSeq, char *dst);
+uint8_t packSample(const sample_t *sample, uint8_t *dst);
+void unpackSample(const uint8_t *src, sample_t *sample);
+
+/* Text output with withSeq set, all the fields and the USB host time */
+#define SERIALIZED_SAMPLE_MAX_SIZE	288
+
+uint16_t serializeStats(const stats_t *stats, outFormat_t format, bool withLast, char *dst);
+
+/* JSON with withLast set, all the fields, every value clamped to 10 digits (~720 for real values).
+   1025 bytes with the '\0', checked in thOutput.c */
+#define SERIALIZED_STATS_MAX_SIZE	1032
+
+/* BINARY stats record: 18 bytes of header, then up to 5 values per field. Upper bound as above */
+#define STATS_RECORD_MAX_SIZE	(18 + 5 * FIELD_COUNT * 4)
+#define STATS_FRAME_MAX_SIZE	(STATS_RECORD_MAX_SIZE + 2 + 2)
+
+/* Sample hand-off, main loop (producer) -> TIM2 interrupt (reporter). Double buffered:
+   the producer fills the slot the reporter can't see, then publishes it with one store */
+sample_t *sampleWriteSlot(void);
+void samplePublish(void);
+const sample_t *sampleLatest(void);
+
+uint16_t crc16Update(uint16_t crc, uint8_t byte);
+uint16_t crc16(const uint8_t *data, uint16_t len);
+uint16_t cobsEncode(const uint8_t *src, uint16_t len, uint8_t *dst);
+uint16_t binaryFrame(const uint8_t *payload, uint16_t len, uint8_t *dst);
@@ -0,0 +1,39 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Low power while the host has the USB bus suspended (thPower.c): the BSEC loop sleeps
+   in STOP mode, woken up by the RTC wakeup timer or by the USB resume. The RTC runs on
+   the LSI as a free running cycle counter, no asynchronous prescaler and the
+   synchronous one wrapping every calendar second */
+#define RTC_SYNCH_PREDIV		0x7FFF
+#define POWER_STOP_MIN_MS		10		/* shorter waits stay in run mode */
+#define POWER_STOP_MAX_MS		4000	/* the IWDG (~10 s) keeps running in STOP */
+
+bool powerSuspended(void);
+void powerSleep(uint32_t period);
+void powerSuspend(void);
+void powerResume(void);
@@ -0,0 +1,90 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Binary requests on the vendor interface, next to the JSON commands.
+   Request:  [COBS(RECORD_TYPE_REQUEST, id (u16), TLV..., CRC16)] [0x00]
+   Response: [COBS(RECORD_TYPE_RESPONSE, id (u16), status, TLV..., CRC16)] [0x00]
+   TLV: tag, length, value (little endian). A value writes the setting, an empty one reads it
+   back in the response. All the TLVs are checked before any is applied: on an error nothing
+   changes and the response is status, tag of the TLV at fault. The reads are done after the
+   writes, the save last. A frame that fails the CRC gets no response.
+   Requests can be pipelined, each response echoes its id. They come in the order sent.
+   BSEC state transfer, to warm start a device with the calibration of another one:
+   export: TAG_STATE_EXPORT, TAG_STATE_STATUS until STATE_XFER_EXPORTED, then TAG_STATE (length,
+   CRC) and the chunks. import: the chunks, then TAG_STATE with the length and CRC (after the
+   chunks when in the same request), TAG_STATE_STATUS until STATE_XFER_IMPORTED (thBsec.h) */
+
+/* Decoded request, CRC included. Its COBS code byte stays below '{': a JSON object and a
+   request frame are told apart by their first byte */
+#define PROTO_REQUEST_MAX		120
+#define PROTO_RESPONSE_MAX		128
+
+/* Response status */
+#define PROTO_OK				0x00
+#define PROTO_MALFORMED			0x01	/* a TLV runs past the end of the request */
+#define PROTO_UNKNOWN_TAG		0x02
+#define PROTO_BAD_LENGTH		0x03
+#define PROTO_OUT_OF_RANGE		0x04
+#define PROTO_READ_ONLY			0x05
+#define PROTO_TOO_LONG			0x06	/* the reads don't fit in a response */
+#define PROTO_SAVE_FAILED		0x07	/* applied, but not stored in flash */
+
+/* Settings, read/write. Same ranges as the JSON keys */
+#define TAG_REPORTING_PERIOD	0x01	/* u16, s, 1..3600 */
+#define TAG_FORMAT				0x02	/* u8, outFormat_t */
+#define TAG_LED					0x03	/* u8, 0/1 */
+#define TAG_TEMPERATURE_OFFSET	0x04	/* i16, 0.01 C, -1500..1500 */
+#define TAG_FIELDS				0x05	/* u16, field mask, not 0 */
+#define TAG_REPORT				0x06	/* u8, reportMode_t */
+#define TAG_STATS_LAST			0x07	/* u8, 0/1 */
+#define TAG_LOG_PERIOD			0x08	/* u16, s, 0 or LOG_PERIOD_MIN.. */
+#define TAG_CATCH_UP			0x09	/* u8, 0/1 */
+#define TAG_HID_INTERVAL		0x0A	/* u32, ms, 0 or HID_INTERVAL_MIN..HID_INTERVAL_MAX */
+#define TAG_HID_SIZE			0x0B	/* u8, 2 or 4, used from the next boot */
+#define TAG_DEADBAND			0x0C	/* u32 per field_t, 0.01 output units, 0..10000000 */
+#define TAG_SAMPLE_RATE			0x0D	/* u8, sampleRate_t */
+#define TAG_STATE				0x0E	/* u16 length, u16 CRC16 of the state. Write: import it */
+/* Read only */
+#define TAG_VERSION				0x40	/* u8 major, minor, patch */
+#define TAG_SERIAL				0x41	/* 16 characters */
+#define TAG_UPTIME				0x42	/* u32, ms */
+#define TAG_SEQ					0x43	/* u32, last sample seq */
+#define TAG_LOG					0x44	/* u32, last flash log record */
+#define TAG_STATE_STATUS		0x45	/* u8, stateXfer_t */
+/* BSEC state, STATE_CHUNK_SIZE bytes from (tag - TAG_STATE_CHUNK) * STATE_CHUNK_SIZE. Read: the
+   exported state, zero filled. Write: the state to import */
+#define TAG_STATE_CHUNK			0x50
+#define STATE_CHUNK_SIZE		48
+#define STATE_CHUNKS			3
+/* Actions, no value */
+#define TAG_SAVE				0x80	/* store the configuration in flash */
+#define TAG_MEASURE				0x81	/* ULP: one more sample, see bsec_iot_measure() */
+#define TAG_STATE_EXPORT		0x82	/* snapshot of the BSEC state, see bsec_iot_state_export() */
+
+bool protoPut(uint8_t byte);
+bool protoIdle(void);
+void protoFlush(void);
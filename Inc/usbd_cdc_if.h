@@ -134,6 +134,20 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+uint8_t *CDC_TxReserve_FS(uint16_t Len);
+void CDC_TxCommit_FS(uint16_t Len);
+void CDC_TxAbort_FS(void);
+uint8_t *VND_TxReserve_FS(uint16_t Len);
+void VND_TxCommit_FS(uint16_t Len);
+void VND_TxAbort_FS(void);
+uint8_t HID_SendReport_FS(uint8_t *Report, uint16_t Len);
+uint8_t MSC_Transmit_FS(uint8_t *Buf, uint16_t Len);
+uint8_t MSC_Receive_FS(uint8_t *Buf, uint16_t Len);
+void MSC_Stall_FS(uint8_t Ep);
+uint16_t CDC_RxRead_FS(uint8_t *Buf, uint16_t Len, uint8_t *End);
+uint8_t CDC_HostListening_FS(void);
+const uint8_t *VND_RxPacket_FS(uint16_t *Len);
+void VND_RxResume_FS(void);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
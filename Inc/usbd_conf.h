@@ -91,11 +91,13 @@
   */
 
 /*---------- -----------*/
-#define USBD_MAX_NUM_INTERFACES     1
+/* highest interface number: CDC control (0), CDC data (1), vendor (2), HID (3), MSC (4) */
+#define USBD_MAX_NUM_INTERFACES     4
 /*---------- -----------*/
 #define USBD_MAX_NUM_CONFIGURATION     1
 /*---------- -----------*/
-#define USBD_MAX_STR_DESC_SIZ     512
+/* longest string: the 16-digit serial number, 34 bytes in UTF-16 */
+#define USBD_MAX_STR_DESC_SIZ     64
 /*---------- -----------*/
 #define USBD_SUPPORT_USER_STRING     0
 /*---------- -----------*/
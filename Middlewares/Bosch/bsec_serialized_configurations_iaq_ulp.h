@@ -0,0 +1,4 @@
+#include <stdint.h>
+
+extern const uint8_t bsec_config_iaq_ulp[454];
+
@@ -50,15 +50,41 @@
   * @{
   */ 
 #define CDC_IN_EP                                   0x81  /* EP1 for data IN */
-#define CDC_OUT_EP                                  0x01  /* EP1 for data OUT */
+#define CDC_OUT_EP                                  0x03  /* EP3 for data OUT, EP1 is double buffered IN */
 #define CDC_CMD_EP                                  0x82  /* EP2 for CDC commands */
 
+/* Vendor specific interface, after the CDC function: binary records for libusb hosts */
+#define VND_INTERFACE                               0x02
+#define VND_IN_EP                                   0x84  /* EP4 for vendor data IN */
+#define VND_OUT_EP                                  0x04  /* EP4 for vendor data OUT */
+
+/* HID Sensor interface, last: the report descriptor is built by thHid.c */
+#define HID_INTERFACE                               0x03
+#define HID_IN_EP                                   0x85  /* EP5 for HID input reports */
+#define HID_PACKET_SIZE                             16
+#define HID_POLL_INTERVAL                           0x0A  /* ms */
+#define HID_REPORT_DESC_SIZ                         225
+#define USB_HID_DESC_SIZ                            9
+#define HID_DESCRIPTOR_TYPE                         0x21
+#define HID_REPORT_DESC                             0x22
+
+/* Mass storage interface, bulk-only transport: the read-only log volume of thDisk.c */
+#define MSC_INTERFACE                               0x04
+#define MSC_IN_EP                                   0x86  /* EP6 for MSC data IN */
+#define MSC_OUT_EP                                  0x06  /* EP6 for MSC data OUT */
+#define MSC_PACKET_SIZE                             64
+
 /* CDC Endpoints parameters: you can fine tune these values depending on the needed baudrates and performance. */
 #define CDC_DATA_HS_MAX_PACKET_SIZE                 512  /* Endpoint IN & OUT Packet size */
 #define CDC_DATA_FS_MAX_PACKET_SIZE                 64  /* Endpoint IN & OUT Packet size */
 #define CDC_CMD_PACKET_SIZE                         8  /* Control Endpoint Packet size */ 
 
-#define USB_CDC_CONFIG_DESC_SIZ                     67
+#define VND_DATA_HS_MAX_PACKET_SIZE                 512  /* Endpoint IN & OUT Packet size */
+#define VND_DATA_FS_MAX_PACKET_SIZE                 64  /* Endpoint IN & OUT Packet size */
+
+/* CDC (67) + interface association (8) + vendor interface and endpoints (23)
+   + HID interface, HID descriptor and endpoint (25) + MSC interface and endpoints (23) */
+#define USB_CDC_CONFIG_DESC_SIZ                     146
 #define CDC_DATA_HS_IN_PACKET_SIZE                  CDC_DATA_HS_MAX_PACKET_SIZE
 #define CDC_DATA_HS_OUT_PACKET_SIZE                 CDC_DATA_HS_MAX_PACKET_SIZE
 
@@ -78,6 +104,22 @@
 #define CDC_SET_CONTROL_LINE_STATE                  0x22
 #define CDC_SEND_BREAK                              0x23
 
+/*---------------------------------------------------------------------*/
+/*  HID definitions                                                    */
+/*---------------------------------------------------------------------*/
+#define HID_REQ_GET_REPORT                          0x01
+#define HID_REQ_GET_IDLE                            0x02
+#define HID_REQ_GET_PROTOCOL                        0x03
+#define HID_REQ_SET_REPORT                          0x09
+#define HID_REQ_SET_IDLE                            0x0A
+#define HID_REQ_SET_PROTOCOL                        0x0B
+
+/*---------------------------------------------------------------------*/
+/*  MSC bulk-only transport definitions                                */
+/*---------------------------------------------------------------------*/
+#define BOT_GET_MAX_LUN                             0xFE
+#define BOT_RESET                                   0xFF
+
 /**
   * @}
   */ 
@@ -104,6 +146,14 @@ typedef struct _USBD_CDC_Itf
   int8_t (* DeInit)        (void);
   int8_t (* Control)       (uint8_t, uint8_t * , uint16_t);   
   int8_t (* Receive)       (uint8_t *, uint32_t *);  
+  int8_t (* TransmitCplt)  (uint8_t *, uint32_t *, uint8_t);
+  int8_t (* VendorReceive) (uint8_t *, uint32_t *);
+  uint8_t *(* HidReportDesc)(uint16_t *);
+  int8_t (* HidGetReport)  (uint8_t, uint8_t, uint8_t *, uint16_t *);
+  int8_t (* HidSetReport)  (uint8_t, uint8_t, uint8_t *, uint16_t);
+  int8_t (* MscReset)      (void);
+  int8_t (* MscReceive)    (uint32_t);
+  int8_t (* MscClearHalt)  (uint8_t);
 
 }USBD_CDC_ItfTypeDef;
 
@@ -120,6 +170,20 @@ typedef struct
   
   __IO uint32_t TxState;     
   __IO uint32_t RxState;    
+
+  /* vendor interface */
+  uint8_t  *VndRxBuffer;
+  uint8_t  *VndTxBuffer;
+  uint32_t VndRxLength;
+  uint32_t VndTxLength;
+  __IO uint32_t VndTxState;
+
+  /* HID interface */
+  __IO uint32_t HidTxState;
+  uint16_t CmdValue;         /* SET_REPORT wValue, report type and ID */
+  uint8_t  CmdItf;           /* interface of the pending EP0 OUT data stage */
+  uint8_t  HidIdle;
+  uint8_t  HidProtocol;
 }
 USBD_CDC_HandleTypeDef; 
 
@@ -159,6 +223,32 @@ uint8_t  USBD_CDC_SetRxBuffer        (USBD_HandleTypeDef   *pdev,
 uint8_t  USBD_CDC_ReceivePacket      (USBD_HandleTypeDef *pdev);
 
 uint8_t  USBD_CDC_TransmitPacket     (USBD_HandleTypeDef *pdev);
+
+uint8_t  USBD_CDC_SetVendorTxBuffer  (USBD_HandleTypeDef   *pdev,
+                                      uint8_t  *pbuff,
+                                      uint16_t length);
+
+uint8_t  USBD_CDC_SetVendorRxBuffer  (USBD_HandleTypeDef   *pdev,
+                                      uint8_t  *pbuff);
+
+uint8_t  USBD_CDC_VendorReceivePacket(USBD_HandleTypeDef *pdev);
+
+uint8_t  USBD_CDC_VendorTransmitPacket(USBD_HandleTypeDef *pdev);
+
+uint8_t  USBD_CDC_HidSendReport      (USBD_HandleTypeDef *pdev,
+                                      uint8_t *report,
+                                      uint16_t len);
+
+uint8_t  USBD_CDC_MscTransmit        (USBD_HandleTypeDef *pdev,
+                                      uint8_t *pbuff,
+                                      uint16_t length);
+
+uint8_t  USBD_CDC_MscPrepareReceive  (USBD_HandleTypeDef *pdev,
+                                      uint8_t *pbuff,
+                                      uint16_t length);
+
+uint8_t  USBD_CDC_MscStall           (USBD_HandleTypeDef *pdev,
+                                      uint8_t ep_addr);
 /**
   * @}
   */ 
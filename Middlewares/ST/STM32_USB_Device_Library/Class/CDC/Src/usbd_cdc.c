@@ -121,6 +121,12 @@ static uint8_t  USBD_CDC_DataOut (USBD_HandleTypeDef *pdev,
 
 static uint8_t  USBD_CDC_EP0_RxReady (USBD_HandleTypeDef *pdev);
 
+static uint8_t  USBD_CDC_HidSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req);
+
+static uint8_t  USBD_CDC_MscSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req);
+
 static uint8_t  *USBD_CDC_GetFSCfgDesc (uint16_t *length);
 
 static uint8_t  *USBD_CDC_GetHSCfgDesc (uint16_t *length);
@@ -146,6 +152,20 @@ __ALIGN_BEGIN static uint8_t USBD_CDC_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_
   0x00,
 };
 
+/* HID descriptor, the copy in the configuration descriptor for GET_DESCRIPTOR */
+__ALIGN_BEGIN static uint8_t USBD_CDC_HidDesc[USB_HID_DESC_SIZ] __ALIGN_END =
+{
+  USB_HID_DESC_SIZ,   /* bLength: HID Descriptor size */
+  HID_DESCRIPTOR_TYPE,   /* bDescriptorType: HID */
+  0x11,   /* bcdHID: 1.11 */
+  0x01,
+  0x00,   /* bCountryCode: not localized */
+  0x01,   /* bNumDescriptors */
+  HID_REPORT_DESC,   /* bDescriptorType: Report */
+  LOBYTE(HID_REPORT_DESC_SIZ),   /* wDescriptorLength */
+  HIBYTE(HID_REPORT_DESC_SIZ),
+};
+
 /**
   * @}
   */ 
@@ -182,7 +202,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgHSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   USB_DESC_TYPE_CONFIGURATION,      /* bDescriptorType: Configuration */
   USB_CDC_CONFIG_DESC_SIZ,                /* wTotalLength:no of returned bytes */
   0x00,
-  0x02,   /* bNumInterfaces: 2 interface */
+  0x05,   /* bNumInterfaces: 5 interfaces */
   0x01,   /* bConfigurationValue: Configuration value */
   0x00,   /* iConfiguration: Index of string descriptor describing the configuration */
   0xC0,   /* bmAttributes: self powered */
@@ -190,6 +210,16 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgHSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   
   /*---------------------------------------------------------------------------*/
   
+  /*Interface Association Descriptor: the CDC function, interfaces 0 and 1*/
+  0x08,   /* bLength: IAD size */
+  0x0B,   /* bDescriptorType: Interface Association */
+  0x00,   /* bFirstInterface */
+  0x02,   /* bInterfaceCount */
+  0x02,   /* bFunctionClass: Communication Interface Class */
+  0x02,   /* bFunctionSubClass: Abstract Control Model */
+  0x01,   /* bFunctionProtocol: Common AT commands */
+  0x00,   /* iFunction */
+  
   /*Interface Descriptor */
   0x09,   /* bLength: Interface Descriptor size */
   USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
@@ -266,6 +296,101 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgHSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   0x02,                              /* bmAttributes: Bulk */
   LOBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
   HIBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*Vendor interface descriptor: binary records and commands, no class driver*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  VND_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass: */
+  0x00,   /* bInterfaceProtocol: */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  VND_OUT_EP,                        /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(VND_DATA_HS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(VND_DATA_HS_MAX_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  VND_IN_EP,                         /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(VND_DATA_HS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(VND_DATA_HS_MAX_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*HID interface descriptor: environmental sensors, HID Sensor usage page*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  HID_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0x03,   /* bInterfaceClass: HID */
+  0x00,   /* bInterfaceSubClass: no boot interface */
+  0x00,   /* bInterfaceProtocol: none */
+  0x00,   /* iInterface: */
+  
+  /*HID Descriptor*/
+  USB_HID_DESC_SIZ,   /* bLength: HID Descriptor size */
+  HID_DESCRIPTOR_TYPE,   /* bDescriptorType: HID */
+  0x11,   /* bcdHID: 1.11 */
+  0x01,
+  0x00,   /* bCountryCode: not localized */
+  0x01,   /* bNumDescriptors */
+  HID_REPORT_DESC,   /* bDescriptorType: Report */
+  LOBYTE(HID_REPORT_DESC_SIZ),   /* wDescriptorLength */
+  HIBYTE(HID_REPORT_DESC_SIZ),
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_IN_EP,                         /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(HID_PACKET_SIZE),
+  HID_POLL_INTERVAL,                 /* bInterval */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*Mass storage interface descriptor: the sample log as a read-only CSV file*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  MSC_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x08,   /* bInterfaceClass: Mass Storage */
+  0x06,   /* bInterfaceSubClass: SCSI transparent */
+  0x50,   /* bInterfaceProtocol: Bulk-Only Transport */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_IN_EP,                         /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(MSC_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_OUT_EP,                        /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(MSC_PACKET_SIZE),
   0x00                               /* bInterval: ignore for Bulk transfer */
 } ;
 
@@ -278,7 +403,7 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgFSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   USB_DESC_TYPE_CONFIGURATION,      /* bDescriptorType: Configuration */
   USB_CDC_CONFIG_DESC_SIZ,                /* wTotalLength:no of returned bytes */
   0x00,
-  0x02,   /* bNumInterfaces: 2 interface */
+  0x05,   /* bNumInterfaces: 5 interfaces */
   0x01,   /* bConfigurationValue: Configuration value */
   0x00,   /* iConfiguration: Index of string descriptor describing the configuration */
   0xC0,   /* bmAttributes: self powered */
@@ -286,6 +411,16 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgFSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   
   /*---------------------------------------------------------------------------*/
   
+  /*Interface Association Descriptor: the CDC function, interfaces 0 and 1*/
+  0x08,   /* bLength: IAD size */
+  0x0B,   /* bDescriptorType: Interface Association */
+  0x00,   /* bFirstInterface */
+  0x02,   /* bInterfaceCount */
+  0x02,   /* bFunctionClass: Communication Interface Class */
+  0x02,   /* bFunctionSubClass: Abstract Control Model */
+  0x01,   /* bFunctionProtocol: Common AT commands */
+  0x00,   /* iFunction */
+  
   /*Interface Descriptor */
   0x09,   /* bLength: Interface Descriptor size */
   USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
@@ -362,6 +497,101 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgFSDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   0x02,                              /* bmAttributes: Bulk */
   LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
   HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*Vendor interface descriptor: binary records and commands, no class driver*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  VND_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass: */
+  0x00,   /* bInterfaceProtocol: */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  VND_OUT_EP,                        /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(VND_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(VND_DATA_FS_MAX_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  VND_IN_EP,                         /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(VND_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(VND_DATA_FS_MAX_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*HID interface descriptor: environmental sensors, HID Sensor usage page*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  HID_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0x03,   /* bInterfaceClass: HID */
+  0x00,   /* bInterfaceSubClass: no boot interface */
+  0x00,   /* bInterfaceProtocol: none */
+  0x00,   /* iInterface: */
+  
+  /*HID Descriptor*/
+  USB_HID_DESC_SIZ,   /* bLength: HID Descriptor size */
+  HID_DESCRIPTOR_TYPE,   /* bDescriptorType: HID */
+  0x11,   /* bcdHID: 1.11 */
+  0x01,
+  0x00,   /* bCountryCode: not localized */
+  0x01,   /* bNumDescriptors */
+  HID_REPORT_DESC,   /* bDescriptorType: Report */
+  LOBYTE(HID_REPORT_DESC_SIZ),   /* wDescriptorLength */
+  HIBYTE(HID_REPORT_DESC_SIZ),
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_IN_EP,                         /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(HID_PACKET_SIZE),
+  HID_POLL_INTERVAL,                 /* bInterval */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*Mass storage interface descriptor: the sample log as a read-only CSV file*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  MSC_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x08,   /* bInterfaceClass: Mass Storage */
+  0x06,   /* bInterfaceSubClass: SCSI transparent */
+  0x50,   /* bInterfaceProtocol: Bulk-Only Transport */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_IN_EP,                         /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(MSC_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_OUT_EP,                        /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(MSC_PACKET_SIZE),
   0x00                               /* bInterval: ignore for Bulk transfer */
 } ;
 
@@ -371,12 +601,22 @@ __ALIGN_BEGIN uint8_t USBD_CDC_OtherSpeedCfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIG
   USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION,   
   USB_CDC_CONFIG_DESC_SIZ,
   0x00,
-  0x02,   /* bNumInterfaces: 2 interfaces */
+  0x05,   /* bNumInterfaces: 5 interfaces */
   0x01,   /* bConfigurationValue: */
   0x04,   /* iConfiguration: */
   0xC0,   /* bmAttributes: */
   0x32,   /* MaxPower 100 mA */  
   
+  /*Interface Association Descriptor: the CDC function, interfaces 0 and 1*/
+  0x08,   /* bLength: IAD size */
+  0x0B,   /* bDescriptorType: Interface Association */
+  0x00,   /* bFirstInterface */
+  0x02,   /* bInterfaceCount */
+  0x02,   /* bFunctionClass: Communication Interface Class */
+  0x02,   /* bFunctionSubClass: Abstract Control Model */
+  0x01,   /* bFunctionProtocol: Common AT commands */
+  0x00,   /* iFunction */
+  
   /*Interface Descriptor */
   0x09,   /* bLength: Interface Descriptor size */
   USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: Interface */
@@ -454,8 +694,103 @@ __ALIGN_BEGIN uint8_t USBD_CDC_OtherSpeedCfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIG
   0x02,                             /* bmAttributes: Bulk */
   0x40,                             /* wMaxPacketSize: */
   0x00,
-  0x00                              /* bInterval */
-};
+  0x00,                             /* bInterval */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*Vendor interface descriptor: binary records and commands, no class driver*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  VND_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0xFF,   /* bInterfaceClass: Vendor specific */
+  0x00,   /* bInterfaceSubClass: */
+  0x00,   /* bInterfaceProtocol: */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  VND_OUT_EP,                        /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(VND_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(VND_DATA_FS_MAX_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  VND_IN_EP,                         /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(VND_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(VND_DATA_FS_MAX_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*HID interface descriptor: environmental sensors, HID Sensor usage page*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  HID_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x01,   /* bNumEndpoints: One endpoint used */
+  0x03,   /* bInterfaceClass: HID */
+  0x00,   /* bInterfaceSubClass: no boot interface */
+  0x00,   /* bInterfaceProtocol: none */
+  0x00,   /* iInterface: */
+  
+  /*HID Descriptor*/
+  USB_HID_DESC_SIZ,   /* bLength: HID Descriptor size */
+  HID_DESCRIPTOR_TYPE,   /* bDescriptorType: HID */
+  0x11,   /* bcdHID: 1.11 */
+  0x01,
+  0x00,   /* bCountryCode: not localized */
+  0x01,   /* bNumDescriptors */
+  HID_REPORT_DESC,   /* bDescriptorType: Report */
+  LOBYTE(HID_REPORT_DESC_SIZ),   /* wDescriptorLength */
+  HIBYTE(HID_REPORT_DESC_SIZ),
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  HID_IN_EP,                         /* bEndpointAddress */
+  0x03,                              /* bmAttributes: Interrupt */
+  LOBYTE(HID_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(HID_PACKET_SIZE),
+  HID_POLL_INTERVAL,                 /* bInterval */
+  
+  /*---------------------------------------------------------------------------*/
+  
+  /*Mass storage interface descriptor: the sample log as a read-only CSV file*/
+  0x09,   /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,  /* bDescriptorType: */
+  MSC_INTERFACE,   /* bInterfaceNumber: Number of Interface */
+  0x00,   /* bAlternateSetting: Alternate setting */
+  0x02,   /* bNumEndpoints: Two endpoints used */
+  0x08,   /* bInterfaceClass: Mass Storage */
+  0x06,   /* bInterfaceSubClass: SCSI transparent */
+  0x50,   /* bInterfaceProtocol: Bulk-Only Transport */
+  0x00,   /* iInterface: */
+  
+  /*Endpoint IN Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_IN_EP,                         /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(MSC_PACKET_SIZE),
+  0x00,                              /* bInterval: ignore for Bulk transfer */
+  
+  /*Endpoint OUT Descriptor*/
+  0x07,   /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  MSC_OUT_EP,                        /* bEndpointAddress */
+  0x02,                              /* bmAttributes: Bulk */
+  LOBYTE(MSC_PACKET_SIZE),           /* wMaxPacketSize: */
+  HIBYTE(MSC_PACKET_SIZE),
+  0x00                               /* bInterval: ignore for Bulk transfer */
+} ;
 
 /**
   * @}
@@ -513,6 +848,34 @@ static uint8_t  USBD_CDC_Init (USBD_HandleTypeDef *pdev,
                  USBD_EP_TYPE_INTR,
                  CDC_CMD_PACKET_SIZE);
   
+  /* Open vendor EPs */
+  USBD_LL_OpenEP(pdev,
+                 VND_IN_EP,
+                 USBD_EP_TYPE_BULK,
+                 VND_DATA_FS_MAX_PACKET_SIZE);
+  
+  USBD_LL_OpenEP(pdev,
+                 VND_OUT_EP,
+                 USBD_EP_TYPE_BULK,
+                 VND_DATA_FS_MAX_PACKET_SIZE);
+  
+  /* Open HID IN EP */
+  USBD_LL_OpenEP(pdev,
+                 HID_IN_EP,
+                 USBD_EP_TYPE_INTR,
+                 HID_PACKET_SIZE);
+  
+  /* Open MSC EPs */
+  USBD_LL_OpenEP(pdev,
+                 MSC_IN_EP,
+                 USBD_EP_TYPE_BULK,
+                 MSC_PACKET_SIZE);
+  
+  USBD_LL_OpenEP(pdev,
+                 MSC_OUT_EP,
+                 USBD_EP_TYPE_BULK,
+                 MSC_PACKET_SIZE);
+  
     
   pdev->pClassData = USBD_malloc(sizeof (USBD_CDC_HandleTypeDef));
   
@@ -530,6 +893,12 @@ static uint8_t  USBD_CDC_Init (USBD_HandleTypeDef *pdev,
     /* Init Xfer states */
     hcdc->TxState =0;
     hcdc->RxState =0;
+    hcdc->VndTxState =0;
+    hcdc->HidTxState =0;
+    hcdc->CmdOpCode = 0xFF;
+    hcdc->CmdItf = 0xFF;
+    hcdc->HidIdle = 0;
+    hcdc->HidProtocol = 1;   /* report protocol */
        
     if(pdev->dev_speed == USBD_SPEED_HIGH  ) 
     {      
@@ -548,7 +917,14 @@ static uint8_t  USBD_CDC_Init (USBD_HandleTypeDef *pdev,
                              CDC_DATA_FS_OUT_PACKET_SIZE);
     }
     
+    /* Prepare vendor Out endpoint to receive the first packet */
+    USBD_LL_PrepareReceive(pdev,
+                           VND_OUT_EP,
+                           hcdc->VndRxBuffer,
+                           VND_DATA_FS_MAX_PACKET_SIZE);
     
+    /* MSC: ready for the first command block wrapper */
+    ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->MscReset();
   }
   return ret;
 }
@@ -577,6 +953,22 @@ static uint8_t  USBD_CDC_DeInit (USBD_HandleTypeDef *pdev,
   USBD_LL_CloseEP(pdev,
               CDC_CMD_EP);
   
+  /* Close vendor EPs */
+  USBD_LL_CloseEP(pdev,
+              VND_IN_EP);
+  USBD_LL_CloseEP(pdev,
+              VND_OUT_EP);
+  
+  /* Close HID IN EP */
+  USBD_LL_CloseEP(pdev,
+              HID_IN_EP);
+  
+  /* Close MSC EPs */
+  USBD_LL_CloseEP(pdev,
+              MSC_IN_EP);
+  USBD_LL_CloseEP(pdev,
+              MSC_OUT_EP);
+  
   
   /* DeInit  physical Interface components */
   if(pdev->pClassData != NULL)
@@ -601,6 +993,20 @@ static uint8_t  USBD_CDC_Setup (USBD_HandleTypeDef *pdev,
 {
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
   static uint8_t ifalt = 0;
+  
+  if(((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_INTERFACE) &&
+     (LOBYTE(req->wIndex) == HID_INTERFACE))
+  {
+    return USBD_CDC_HidSetup(pdev, req);
+  }
+  
+  if((((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_INTERFACE) &&
+      (LOBYTE(req->wIndex) == MSC_INTERFACE)) ||
+     (((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_ENDPOINT) &&
+      ((LOBYTE(req->wIndex) & 0x7F) == (MSC_IN_EP & 0x7F))))
+  {
+    return USBD_CDC_MscSetup(pdev, req);
+  }
     
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
@@ -654,6 +1060,193 @@ static uint8_t  USBD_CDC_Setup (USBD_HandleTypeDef *pdev,
   return USBD_OK;
 }
 
+/**
+  * @brief  USBD_CDC_HidSetup
+  *         Handle the HID class requests and the HID descriptor requests
+  * @param  pdev: instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t  USBD_CDC_HidSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req)
+{
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  USBD_CDC_ItfTypeDef      *itf = (USBD_CDC_ItfTypeDef *)pdev->pUserData;
+  static uint8_t ifalt = 0;
+  uint8_t  *pbuf = NULL;
+  uint16_t len = 0;
+  
+  switch (req->bmRequest & USB_REQ_TYPE_MASK)
+  {
+  case USB_REQ_TYPE_CLASS :
+    switch (req->bRequest)
+    {
+    case HID_REQ_GET_REPORT:
+      /* wValue: report type, report ID */
+      if(itf->HidGetReport(HIBYTE(req->wValue), LOBYTE(req->wValue),
+                           (uint8_t *)hcdc->data, &len) != USBD_OK)
+      {
+        USBD_CtlError(pdev, req);
+        return USBD_FAIL;
+      }
+      USBD_CtlSendData (pdev, 
+                        (uint8_t *)hcdc->data,
+                        MIN(len, req->wLength));
+      break;
+      
+    case HID_REQ_SET_REPORT:
+      /* the report comes in the data stage, see USBD_CDC_EP0_RxReady */
+      hcdc->CmdItf = HID_INTERFACE;
+      hcdc->CmdValue = req->wValue;
+      hcdc->CmdLength = MIN(req->wLength, HID_PACKET_SIZE);
+      USBD_CtlPrepareRx (pdev, 
+                         (uint8_t *)hcdc->data,
+                         hcdc->CmdLength);
+      break;
+      
+    case HID_REQ_SET_IDLE:
+      hcdc->HidIdle = HIBYTE(req->wValue);
+      break;
+      
+    case HID_REQ_GET_IDLE:
+      USBD_CtlSendData (pdev,
+                        &hcdc->HidIdle,
+                        1);
+      break;
+      
+    case HID_REQ_SET_PROTOCOL:
+      hcdc->HidProtocol = LOBYTE(req->wValue);
+      break;
+      
+    case HID_REQ_GET_PROTOCOL:
+      USBD_CtlSendData (pdev,
+                        &hcdc->HidProtocol,
+                        1);
+      break;
+      
+    default:
+      USBD_CtlError(pdev, req);
+      return USBD_FAIL;
+    }
+    break;
+    
+  case USB_REQ_TYPE_STANDARD:
+    switch (req->bRequest)
+    {
+    case USB_REQ_GET_DESCRIPTOR:
+      if(HIBYTE(req->wValue) == HID_REPORT_DESC)
+      {
+        pbuf = itf->HidReportDesc(&len);
+      }
+      else if(HIBYTE(req->wValue) == HID_DESCRIPTOR_TYPE)
+      {
+        pbuf = USBD_CDC_HidDesc;
+        len = sizeof (USBD_CDC_HidDesc);
+      }
+      else
+      {
+        USBD_CtlError(pdev, req);
+        return USBD_FAIL;
+      }
+      USBD_CtlSendData (pdev,
+                        pbuf,
+                        MIN(len, req->wLength));
+      break;
+      
+    case USB_REQ_GET_INTERFACE :
+      USBD_CtlSendData (pdev,
+                        &ifalt,
+                        1);
+      break;
+      
+    case USB_REQ_SET_INTERFACE :
+      break;
+    }
+    break;
+    
+  default: 
+    break;
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CDC_MscSetup
+  *         Handle the bulk-only transport class requests, and the halt
+  *         cleared on the MSC endpoints
+  * @param  pdev: instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t  USBD_CDC_MscSetup (USBD_HandleTypeDef *pdev, 
+                                   USBD_SetupReqTypedef *req)
+{
+  USBD_CDC_ItfTypeDef      *itf = (USBD_CDC_ItfTypeDef *)pdev->pUserData;
+  static uint8_t ifalt = 0;
+  static uint8_t maxLun = 0;
+  
+  switch (req->bmRequest & USB_REQ_TYPE_MASK)
+  {
+  case USB_REQ_TYPE_CLASS :
+    switch (req->bRequest)
+    {
+    case BOT_GET_MAX_LUN:
+      if((req->wValue == 0) && (req->wLength == 1) && (req->bmRequest & 0x80))
+      {
+        USBD_CtlSendData (pdev,
+                          &maxLun,
+                          1);
+      }
+      else
+      {
+        USBD_CtlError(pdev, req);
+        return USBD_FAIL;
+      }
+      break;
+      
+    case BOT_RESET:
+      if((req->wValue == 0) && (req->wLength == 0) && !(req->bmRequest & 0x80))
+      {
+        itf->MscReset();
+      }
+      else
+      {
+        USBD_CtlError(pdev, req);
+        return USBD_FAIL;
+      }
+      break;
+      
+    default:
+      USBD_CtlError(pdev, req);
+      return USBD_FAIL;
+    }
+    break;
+    
+  case USB_REQ_TYPE_STANDARD:
+    switch (req->bRequest)
+    {
+    case USB_REQ_GET_INTERFACE :
+      USBD_CtlSendData (pdev,
+                        &ifalt,
+                        1);
+      break;
+      
+    case USB_REQ_SET_INTERFACE :
+      break;
+      
+    case USB_REQ_CLEAR_FEATURE:
+      /* the core has cleared the stall already, the transport may set it again */
+      itf->MscClearHalt(LOBYTE(req->wIndex));
+      break;
+    }
+    break;
+    
+  default: 
+    break;
+  }
+  return USBD_OK;
+}
+
 /**
   * @brief  USBD_CDC_DataIn
   *         Data sent on non-control IN endpoint
@@ -667,9 +1260,60 @@ static uint8_t  USBD_CDC_DataIn (USBD_HandleTypeDef *pdev, uint8_t epnum)
   
   if(pdev->pClassData != NULL)
   {
+    if(epnum == (MSC_IN_EP & 0x7F))
+    {
+      ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt(NULL, NULL, epnum);
+      return USBD_OK;
+    }
+    
+    if(epnum == (HID_IN_EP & 0x7F))
+    {
+      hcdc->HidTxState = 0;
+      
+      if(((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt != NULL)
+      {
+        ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt(NULL, NULL, epnum);
+      }
+      
+      return USBD_OK;
+    }
+    
+    if(epnum == (VND_IN_EP & 0x7F))
+    {
+      if((hcdc->VndTxLength > 0) && ((hcdc->VndTxLength % VND_DATA_FS_MAX_PACKET_SIZE) == 0))
+      {
+        /* same as the CDC data below: a full last packet needs a zero-length one */
+        hcdc->VndTxLength = 0;
+        USBD_LL_Transmit(pdev, VND_IN_EP, NULL, 0);
+        return USBD_OK;
+      }
+      
+      hcdc->VndTxState = 0;
+      
+      if(((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt != NULL)
+      {
+        ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt(hcdc->VndTxBuffer, &hcdc->VndTxLength, epnum);
+      }
+      
+      return USBD_OK;
+    }
+    
+    if((hcdc->TxLength > 0) && ((hcdc->TxLength % CDC_DATA_FS_IN_PACKET_SIZE) == 0))
+    {
+      /* The transfer ended on a full packet: the host only sees its end
+         with a short one, send a zero-length packet */
+      hcdc->TxLength = 0;
+      USBD_LL_Transmit(pdev, CDC_IN_EP, NULL, 0);
+      return USBD_OK;
+    }
     
     hcdc->TxState = 0;
 
+    if(((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt != NULL)
+    {
+      ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt(hcdc->TxBuffer, &hcdc->TxLength, epnum);
+    }
+
     return USBD_OK;
   }
   else
@@ -689,13 +1333,27 @@ static uint8_t  USBD_CDC_DataOut (USBD_HandleTypeDef *pdev, uint8_t epnum)
 {      
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
   
-  /* Get the received data length */
-  hcdc->RxLength = USBD_LL_GetRxDataSize (pdev, epnum);
-  
   /* USB data will be immediately processed, this allow next USB traffic being 
   NAKed till the end of the application Xfer */
   if(pdev->pClassData != NULL)
   {
+    if(epnum == MSC_OUT_EP)
+    {
+      ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->MscReceive(USBD_LL_GetRxDataSize (pdev, epnum));
+      return USBD_OK;
+    }
+    
+    if(epnum == VND_OUT_EP)
+    {
+      hcdc->VndRxLength = USBD_LL_GetRxDataSize (pdev, epnum);
+      ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->VendorReceive(hcdc->VndRxBuffer, &hcdc->VndRxLength);
+      
+      return USBD_OK;
+    }
+    
+    /* Get the received data length */
+    hcdc->RxLength = USBD_LL_GetRxDataSize (pdev, epnum);
+    
     ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->Receive(hcdc->RxBuffer, &hcdc->RxLength);
 
     return USBD_OK;
@@ -719,6 +1377,16 @@ static uint8_t  USBD_CDC_EP0_RxReady (USBD_HandleTypeDef *pdev)
 { 
   USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
   
+  if((pdev->pUserData != NULL) && (hcdc->CmdItf == HID_INTERFACE))
+  {
+    ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->HidSetReport(HIBYTE(hcdc->CmdValue),
+                                                           LOBYTE(hcdc->CmdValue),
+                                                           (uint8_t *)hcdc->data,
+                                                           hcdc->CmdLength);
+    hcdc->CmdItf = 0xFF;
+    return USBD_OK;
+  }
+  
   if((pdev->pUserData != NULL) && (hcdc->CmdOpCode != 0xFF))
   {
     ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->Control(hcdc->CmdOpCode,
@@ -910,6 +1578,178 @@ uint8_t  USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev)
     return USBD_FAIL;
   }
 }
+
+/**
+  * @brief  USBD_CDC_SetVendorTxBuffer
+  * @param  pdev: device instance
+  * @param  pbuff: Tx Buffer
+  * @param  length: Number of data to be sent
+  * @retval status
+  */
+uint8_t  USBD_CDC_SetVendorTxBuffer  (USBD_HandleTypeDef   *pdev,
+                                      uint8_t  *pbuff,
+                                      uint16_t length)
+{
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  
+  hcdc->VndTxBuffer = pbuff;
+  hcdc->VndTxLength = length;  
+  
+  return USBD_OK;  
+}
+
+/**
+  * @brief  USBD_CDC_SetVendorRxBuffer
+  * @param  pdev: device instance
+  * @param  pbuff: Rx Buffer
+  * @retval status
+  */
+uint8_t  USBD_CDC_SetVendorRxBuffer  (USBD_HandleTypeDef   *pdev,
+                                      uint8_t  *pbuff)
+{
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  
+  hcdc->VndRxBuffer = pbuff;
+  
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CDC_VendorTransmitPacket
+  *         Send the vendor Tx buffer on the vendor IN endpoint
+  * @param  pdev: device instance
+  * @retval status
+  */
+uint8_t  USBD_CDC_VendorTransmitPacket(USBD_HandleTypeDef *pdev)
+{      
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  
+  if(pdev->pClassData == NULL)
+  {
+    return USBD_FAIL;
+  }
+  if(hcdc->VndTxState != 0)
+  {
+    return USBD_BUSY;
+  }
+  hcdc->VndTxState = 1;
+  USBD_LL_Transmit(pdev,
+                   VND_IN_EP,
+                   hcdc->VndTxBuffer,
+                   hcdc->VndTxLength);
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CDC_VendorReceivePacket
+  *         prepare the vendor OUT Endpoint for reception
+  * @param  pdev: device instance
+  * @retval status
+  */
+uint8_t  USBD_CDC_VendorReceivePacket(USBD_HandleTypeDef *pdev)
+{      
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  
+  if(pdev->pClassData == NULL)
+  {
+    return USBD_FAIL;
+  }
+  USBD_LL_PrepareReceive(pdev,
+                         VND_OUT_EP,
+                         hcdc->VndRxBuffer,
+                         VND_DATA_FS_MAX_PACKET_SIZE);
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CDC_HidSendReport
+  *         Send an input report on the HID IN endpoint
+  * @param  pdev: device instance
+  * @param  report: report, ID first, valid until the transfer completes
+  * @param  len: report length
+  * @retval status: USBD_BUSY while the previous report is pending
+  */
+uint8_t  USBD_CDC_HidSendReport(USBD_HandleTypeDef *pdev,
+                                uint8_t *report,
+                                uint16_t len)
+{      
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef*) pdev->pClassData;
+  
+  if((pdev->pClassData == NULL) || (pdev->dev_state != USBD_STATE_CONFIGURED))
+  {
+    return USBD_FAIL;
+  }
+  if(hcdc->HidTxState != 0)
+  {
+    return USBD_BUSY;
+  }
+  hcdc->HidTxState = 1;
+  USBD_LL_Transmit(pdev,
+                   HID_IN_EP,
+                   report,
+                   len);
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CDC_MscTransmit
+  *         Start a transfer on the MSC IN endpoint
+  * @param  pdev: device instance
+  * @param  pbuff: data, valid until the transfer completes
+  * @param  length: data length
+  * @retval status
+  */
+uint8_t  USBD_CDC_MscTransmit(USBD_HandleTypeDef *pdev,
+                              uint8_t *pbuff,
+                              uint16_t length)
+{      
+  if((pdev->pClassData == NULL) || (pdev->dev_state != USBD_STATE_CONFIGURED))
+  {
+    return USBD_FAIL;
+  }
+  USBD_LL_Transmit(pdev,
+                   MSC_IN_EP,
+                   pbuff,
+                   length);
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CDC_MscPrepareReceive
+  *         Prepare the MSC OUT endpoint for the next transfer
+  * @param  pdev: device instance
+  * @param  pbuff: destination buffer
+  * @param  length: buffer size
+  * @retval status
+  */
+uint8_t  USBD_CDC_MscPrepareReceive(USBD_HandleTypeDef *pdev,
+                                    uint8_t *pbuff,
+                                    uint16_t length)
+{      
+  if(pdev->dev_state != USBD_STATE_CONFIGURED)
+  {
+    return USBD_FAIL;
+  }
+  USBD_LL_PrepareReceive(pdev,
+                         MSC_OUT_EP,
+                         pbuff,
+                         length);
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CDC_MscStall
+  *         Halt an MSC endpoint, until the host clears it
+  * @param  pdev: device instance
+  * @param  ep_addr: MSC_IN_EP or MSC_OUT_EP
+  * @retval status
+  */
+uint8_t  USBD_CDC_MscStall(USBD_HandleTypeDef *pdev,
+                           uint8_t ep_addr)
+{      
+  USBD_LL_StallEP(pdev, ep_addr);
+  return USBD_OK;
+}
 /**
   * @}
   */ 
@@ -0,0 +1,247 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include "main.h"
+#include "flashSave.h"
+#include "flashLog.h"
+#include "thConfig.h"
+
+extern IWDG_HandleTypeDef   watchdogHandle;
+extern configs_t thConfig;
+
+/* Page: [LOG_MAGIC][page seq], then LOG_SLOTS records of [LOG_VALID (u16)][packSample() record][pad].
+   The pages are written in a ring, page seq counts every page started so far: all of them
+   get erased equally often, and the oldest one is the next to go.
+   Record index = page seq * LOG_SLOTS + slot, it keeps growing across resets */
+#define LOG_START			(ADDR_FLASH_PAGE_0 + LOG_FIRST_PAGE * FLASH_PAGE_SIZE)
+#define LOG_HEADER_SIZE		8
+#define LOG_RECORD_SIZE		((2 + PACKED_SAMPLE_SIZE + 1) & ~1)	/* half-word programming */
+#define LOG_SLOTS			((FLASH_PAGE_SIZE - LOG_HEADER_SIZE) / LOG_RECORD_SIZE)
+
+static const uint32_t LOG_MAGIC = 0x4C4F4701;
+static const uint16_t LOG_VALID = 0xA55A;
+
+static uint8_t  curPage;			/* page being written */
+static uint32_t curSeq = 0;			/* its page seq, 0: nothing logged yet */
+static uint16_t curSlot;			/* next free slot in curPage */
+static uint32_t oldestSeq = 0;		/* oldest page still in the ring */
+
+static bool     logged = false;
+static uint32_t lastLogTime;		/* sample timestamp of the last record */
+
+static uint32_t pageAddress(uint8_t page)
+{
+	return LOG_START + page * FLASH_PAGE_SIZE;
+}
+
+static uint32_t slotAddress(uint8_t page, uint16_t slot)
+{
+	return pageAddress(page) + LOG_HEADER_SIZE + slot * LOG_RECORD_SIZE;
+}
+
+/* 0 if the page isn't a log page (erased, or the erase was cut short) */
+static uint32_t pageSeq(uint8_t page)
+{
+	uint32_t address = pageAddress(page);
+
+	if (*(volatile uint32_t *)address != LOG_MAGIC) {
+		return 0;
+	}
+	return *(volatile uint32_t *)(address + 4);
+}
+
+static bool slotErased(uint8_t page, uint16_t slot)
+{
+	uint32_t address = slotAddress(page, slot);
+
+	for (int i = 0; i < LOG_RECORD_SIZE; i += 2) {
+		if (*(volatile uint16_t *)(address + i) != 0xFFFF) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Finds the page being written and its first free slot. A record cut by a reset
+   is left behind, the next one goes after it */
+void flashLogInit(void)
+{
+	uint32_t seq;
+	uint8_t page;
+
+	curSeq = 0;
+	for (page = 0; page < LOG_PAGES; page++) {
+		seq = pageSeq(page);
+		if (seq > curSeq) {
+			curSeq = seq;
+			curPage = page;
+		}
+	}
+	if (curSeq == 0) {
+		/* first run, the first record starts the ring */
+		return;
+	}
+
+	oldestSeq = curSeq;
+	for (page = 0; page < LOG_PAGES; page++) {
+		seq = pageSeq(page);
+		if (seq != 0 && seq < oldestSeq && seq + LOG_PAGES > curSeq) {
+			oldestSeq = seq;
+		}
+	}
+
+	curSlot = LOG_SLOTS;
+	while (curSlot > 0 && slotErased(curPage, curSlot - 1)) {
+		curSlot--;
+	}
+
+	UartLog("Sample log: records %lu to %lu in Flash.", flashLogFirst(), flashLogLast());
+}
+
+/* Erases page and writes its header. The interrupts are held off while the flash
+   controller is unlocked: the handlers run from the flash and would stall on every fetch
+   during the erase anyway, and nothing can program the flash between the unlock and the lock */
+static bool startPage(uint8_t page, uint32_t seq)
+{
+	static FLASH_EraseInitTypeDef EraseInitStruct;
+	uint32_t PageError;
+	uint32_t flashAddress = pageAddress(page);
+	HAL_StatusTypeDef ret;
+
+	/* Refresh IWDG: we don't want to be reset during a Flash erase */
+	HAL_IWDG_Refresh(&watchdogHandle);
+
+	EraseInitStruct.TypeErase = FLASH_TYPEERASE_PAGES;
+	EraseInitStruct.PageAddress = flashAddress;
+	EraseInitStruct.NbPages = 1;
+
+	__disable_irq();
+	HAL_FLASH_Unlock();
+	ret = HAL_FLASHEx_Erase(&EraseInitStruct, &PageError);
+	if (ret == HAL_OK) {
+		ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, flashAddress + 4, seq);
+	}
+	if (ret == HAL_OK) {
+		/* the magic goes last, a page with a torn header is ignored */
+		ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, flashAddress, LOG_MAGIC);
+	}
+	HAL_FLASH_Lock();
+	__enable_irq();
+
+	if (ret != HAL_OK) {
+		UartLog("Sample log: page %d erase failed.", LOG_FIRST_PAGE + page);
+		return false;
+	}
+
+	curPage = page;
+	curSeq = seq;
+	curSlot = 0;
+	if (oldestSeq == 0) {
+		oldestSeq = seq;
+	} else if (seq >= oldestSeq + LOG_PAGES) {
+		oldestSeq = seq - LOG_PAGES + 1;
+	}
+	return true;
+}
+
+/* Main loop: logs one sample every thConfig.logPeriod seconds */
+void flashLogAdd(const sample_t *sample)
+{
+	uint16_t record[LOG_RECORD_SIZE / 2];
+	uint32_t flashAddress;
+	HAL_StatusTypeDef ret = HAL_OK;
+
+	if (thConfig.logPeriod == 0 ||
+		(logged && sample->timestamp - lastLogTime < thConfig.logPeriod * 1000UL)) {
+		return;
+	}
+	if (curSeq == 0 || curSlot == LOG_SLOTS) {
+		/* next page in the ring, dropping the oldest records */
+		if (!startPage((curSeq == 0) ? 0 : (curPage + 1) % LOG_PAGES, curSeq + 1)) {
+			return;
+		}
+	}
+
+	memset(record, 0xFF, sizeof(record));
+	packSample(sample, (uint8_t *)&record[1]);
+	flashAddress = slotAddress(curPage, curSlot);
+
+	__disable_irq();
+	HAL_FLASH_Unlock();
+	for (int i = 1; i < LOG_RECORD_SIZE / 2 && ret == HAL_OK; i++) {
+		ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, flashAddress + 2 * i, record[i]);
+	}
+	if (ret == HAL_OK) {
+		/* the marker goes last, a record cut by a reset stays invalid */
+		ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, flashAddress, LOG_VALID);
+	}
+	HAL_FLASH_Lock();
+	__enable_irq();
+
+	/* the slot is used either way */
+	curSlot++;
+	logged = true;
+	lastLogTime = sample->timestamp;
+}
+
+/* Oldest record kept, 0 if the log is empty */
+uint32_t flashLogFirst(void)
+{
+	return (flashLogLast() == 0) ? 0 : oldestSeq * LOG_SLOTS;
+}
+
+/* Newest record, 0 if the log is empty */
+uint32_t flashLogLast(void)
+{
+	if (curSeq == 0 || (curSeq == oldestSeq && curSlot == 0)) {
+		return 0;
+	}
+	return curSeq * LOG_SLOTS + curSlot - 1;
+}
+
+/* Main loop only. False for the records not kept, and for the slots left empty by a reset */
+bool flashLogGet(uint32_t index, sample_t *sample)
+{
+	uint32_t seq = index / LOG_SLOTS;
+	uint16_t slot = index % LOG_SLOTS;
+	uint8_t page;
+	uint32_t flashAddress;
+
+	if (index == 0 || index < flashLogFirst() || index > flashLogLast()) {
+		return false;
+	}
+	page = (curPage + LOG_PAGES - (curSeq - seq)) % LOG_PAGES;
+	if (pageSeq(page) != seq) {
+		return false;
+	}
+	flashAddress = slotAddress(page, slot);
+	if (*(volatile uint16_t *)flashAddress != LOG_VALID) {
+		return false;
+	}
+	unpackSample((const uint8_t *)(flashAddress + 2), sample);
+	sample->seq = index;
+	sample->fieldMask = thConfig.fieldMask;
+	return true;
+}
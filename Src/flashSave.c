@@ -22,6 +22,8 @@
 * SOFTWARE.     
 ****************************************************************************/
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 #include "main.h"
 #include "flashSave.h"
 #include "thConfig.h"
@@ -35,6 +37,12 @@ static const uint32_t configStartAddress = ADDR_FLASH_PAGE_62;
 
 static const uint32_t MAGIC_NUMBER = 0xDEADBEEF;
 
+/* configs_t storage: [CONFIG_MAGIC][length][configs_t]. Fields appended to configs_t keep
+   their defaults when loading a shorter one. The first layout had no length word and
+   used MAGIC_NUMBER, it ends right before fieldMask */
+static const uint32_t CONFIG_MAGIC = 0xC0F16002;
+#define CONFIG_V1_LENGTH	offsetof(configs_t, fieldMask)
+
 /*!
  * @brief           Load previous library state from non-volatile memory
  *
@@ -133,22 +141,29 @@ void state_save(const uint8_t *state_buffer, uint32_t length)
 //***********
 int loadConfig(configs_t *config)
 {
-	volatile uint32_t flashAddress = configStartAddress;
+	uint32_t flashAddress = configStartAddress;
+	uint32_t magic = *(volatile uint32_t*)flashAddress;
+	uint32_t length;
 
-	if (MAGIC_NUMBER != *(volatile uint32_t*)flashAddress){
+	flashAddress += 4;
+	if (magic == CONFIG_MAGIC){
+		length = *(volatile uint32_t*)flashAddress;
+		flashAddress += 4;
+		if (length > sizeof(configs_t)){
+			/* saved by a newer firmware, take what we know */
+			length = sizeof(configs_t);
+		}
+	} else if (magic == MAGIC_NUMBER){
+		length = CONFIG_V1_LENGTH;
+	} else {
 		/* first time (nothing saved yet) or error */
 		return 0;
 	}
-	flashAddress += 4;
-
-	uint8_t length = sizeof(configs_t);
-	volatile uint32_t *ptr = (volatile uint32_t* )config;
 
-	for (int i=0; i < length; i += 4, ptr++, flashAddress += 4){   
-		*ptr = *(volatile uint32_t*)flashAddress;
-	}
+	/* byte copy, the struct isn't a multiple of 4 */
+	memcpy(config, (const void *)flashAddress, length);
 
-	UartLog("uThing Configuration loaded from Flash (%d bytes).", length);
+	UartLog("uThing Configuration loaded from Flash (%d bytes).", (int)length);
 
 	return length;
 }
@@ -179,7 +194,11 @@ int saveConfig(configs_t *config)
     volatile uint32_t flashAddress = configStartAddress;
      
     /* Store the magic number */
-    ret += HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, flashAddress, MAGIC_NUMBER);
+    ret += HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, flashAddress, CONFIG_MAGIC);
+    flashAddress += 4;
+
+    /* Store the config length */
+    ret += HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, flashAddress, sizeof(configs_t));
     flashAddress += 4;
 
     /* Store now the state_buffer, 4 bytes at a time */
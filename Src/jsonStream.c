@@ -0,0 +1,293 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <string.h>
+#include "jsonStream.h"
+
+enum {
+	ST_IDLE = 0,	/* waiting for a '{', a zeroed jsonStream_t starts here */
+	ST_MEMBER,		/* a key or the end of the object */
+	ST_KEY,
+	ST_COLON,
+	ST_VALUE,		/* between the tokens of a value */
+	ST_STRING,
+	ST_PRIMITIVE,
+	ST_NEXT,		/* a member is done: ',' or '}' */
+	ST_ERROR,		/* skipping to the end of the line */
+};
+
+static uint8_t fail(jsonStream_t *js, char c)
+{
+	/* the line that went wrong may be ending right now */
+	js->state = (c == '\n' || c == '\r') ? ST_IDLE : ST_ERROR;
+	return JSON_STREAM_ERROR;
+}
+
+static bool store(jsonMember_t *m, char c)
+{
+	if (m->len >= JSON_MEMBER_MAX) {
+		return false;
+	}
+	m->buf[m->len++] = c;
+	return true;
+}
+
+/* New token starting at the current position, counted by its container */
+static jsmntok_t *token(jsonMember_t *m, jsmntype_t type)
+{
+	if (m->count >= JSON_MEMBER_TOKENS) {
+		return NULL;
+	}
+	jsmntok_t *tok = &m->tokens[m->count++];
+
+	tok->type = type;
+	tok->start = m->len;
+	tok->end = -1;
+	tok->size = 0;
+	if (m->depth > 0) {
+		jsmntok_t *parent = &m->tokens[m->open[m->depth - 1]];
+
+		/* an object counts its keys, as jsmn, and a key its value */
+		if (parent->type == JSMN_ARRAY || m->key) {
+			parent->size++;
+		}
+		if (m->key) {
+			tok->size = 1;
+		}
+	}
+	return tok;
+}
+
+static bool inObject(const jsonMember_t *m)
+{
+	return m->depth > 0 && m->tokens[m->open[m->depth - 1]].type == JSMN_OBJECT;
+}
+
+static bool space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* The last token of the value is complete */
+static uint8_t valueDone(jsonStream_t *js)
+{
+	jsonMember_t *m = js->member;
+
+	if (m->depth > 0) {
+		m->sep = true;
+		js->state = ST_VALUE;
+		return 0;
+	}
+	m->buf[m->len] = '\0';
+	js->state = ST_NEXT;
+	return JSON_STREAM_MEMBER;
+}
+
+static uint8_t valuePut(jsonStream_t *js, char c)
+{
+	jsonMember_t *m = js->member;
+	jsmntok_t *tok;
+
+	if (space(c)) {
+		return 0;
+	}
+	switch (c) {
+		case '{':
+		case '[':
+			if (m->key || m->sep || m->depth == JSON_MEMBER_DEPTH ||
+					(tok = token(m, (c == '{') ? JSMN_OBJECT : JSMN_ARRAY)) == NULL || !store(m, c)) {
+				return fail(js, c);
+			}
+			m->open[m->depth++] = m->count - 1;
+			m->key = (c == '{');
+			return 0;
+
+		case '}':
+		case ']':
+			/* after a value, or empty: not after a ',' or a key */
+			if (m->depth == 0 || (tok = &m->tokens[m->open[m->depth - 1]])->type != ((c == '}') ? JSMN_OBJECT : JSMN_ARRAY) ||
+					(m->sep ? (c == '}' && m->key) : tok->size > 0) || !store(m, c)) {
+				return fail(js, c);
+			}
+			tok->end = m->len;
+			m->depth--;
+			m->key = false;
+			return valueDone(js);
+
+		case ',':
+			if (m->depth == 0 || !m->sep || (inObject(m) && m->key) || !store(m, c)) {
+				return fail(js, c);
+			}
+			m->key = inObject(m);
+			m->sep = false;
+			return 0;
+
+		case ':':
+			if (!inObject(m) || !m->key || !m->sep || !store(m, c)) {
+				return fail(js, c);
+			}
+			m->key = false;
+			m->sep = false;
+			return 0;
+
+		case '"':
+			if (m->sep || !store(m, c) || token(m, JSMN_STRING) == NULL) {
+				return fail(js, c);
+			}
+			js->state = ST_STRING;
+			return 0;
+
+		default:
+			if (m->key || m->sep || token(m, JSMN_PRIMITIVE) == NULL || !store(m, c)) {
+				return fail(js, c);
+			}
+			js->state = ST_PRIMITIVE;
+			return 0;
+	}
+}
+
+/* The input is at a message boundary: stop skipping after an error, an object being read goes on */
+void jsonStreamResync(jsonStream_t *js)
+{
+	if (js->state == ST_ERROR) {
+		js->state = ST_IDLE;
+	}
+}
+
+bool jsonStreamIdle(const jsonStream_t *js)
+{
+	return js->state == ST_IDLE;
+}
+
+uint8_t jsonStreamPut(jsonStream_t *js, char c)
+{
+	jsonMember_t *m = js->member;
+	uint8_t events;
+
+	if (js->state >= ST_KEY && js->state <= ST_PRIMITIVE && m->owner != js) {
+		/* another stream started a member meanwhile */
+		return fail(js, c);
+	}
+	switch (js->state) {
+		case ST_IDLE:
+			/* anything else isn't ours, see processCommands() */
+			if (c == '{') {
+				js->state = ST_MEMBER;
+			}
+			return 0;
+
+		case ST_MEMBER:
+			if (space(c) || c == ',') {
+				return 0;
+			}
+			if (c == '}') {
+				js->state = ST_IDLE;
+				return JSON_STREAM_END;
+			}
+			if (c != '"') {
+				return fail(js, c);
+			}
+			m->owner = js;
+			m->len = 0;
+			m->count = 0;
+			m->depth = 0;
+			m->key = false;
+			m->sep = false;
+			m->escape = false;
+			store(m, c);
+			token(m, JSMN_STRING)->size = 1;
+			js->state = ST_KEY;
+			return 0;
+
+		case ST_KEY:
+		case ST_STRING:
+			if ((uint8_t)c < ' ' || !store(m, c)) {
+				return fail(js, c);
+			}
+			if (m->escape) {
+				m->escape = false;
+			} else if (c == '\\') {
+				m->escape = true;
+			} else if (c == '"') {
+				m->tokens[m->count - 1].end = m->len - 1;
+
+				if (js->state == ST_KEY) {
+					js->state = ST_COLON;
+					return 0;
+				}
+				return valueDone(js);
+			}
+			return 0;
+
+		case ST_COLON:
+			if (space(c)) {
+				return 0;
+			}
+			if (c == ',' || c == '}') {
+				/* {"status"}: a key alone, tokens[0] only */
+				m->buf[m->len] = '\0';
+				js->state = ST_NEXT;
+				return JSON_STREAM_MEMBER | jsonStreamPut(js, c);
+			}
+			if (c != ':' || !store(m, c)) {
+				return fail(js, c);
+			}
+			js->state = ST_VALUE;
+			return 0;
+
+		case ST_VALUE:
+			return valuePut(js, c);
+
+		case ST_PRIMITIVE:
+			if (!space(c) && c != ',' && c != ':' && c != '}' && c != ']') {
+				if (c == '"' || c == '{' || c == '[' || !store(m, c)) {
+					return fail(js, c);
+				}
+				return 0;
+			}
+			/* the delimiter belongs to what comes after */
+			m->tokens[m->count - 1].end = m->len;
+			events = valueDone(js);
+			return events | jsonStreamPut(js, c);
+
+		case ST_NEXT:
+			if (space(c)) {
+				return 0;
+			}
+			if (c == ',') {
+				js->state = ST_MEMBER;
+				return 0;
+			}
+			if (c == '}') {
+				js->state = ST_IDLE;
+				return JSON_STREAM_END;
+			}
+			return fail(js, c);
+
+		default:
+			if (c == '\n' || c == '\r') {
+				js->state = ST_IDLE;
+			}
+			return 0;
+	}
+}
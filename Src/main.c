@@ -21,6 +21,8 @@
 * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 * SOFTWARE.     
 ****************************************************************************/
+#include <string.h>
+#include <math.h>
 #include "main.h"
 #include "usb_device.h"
 #include "usbd_cdc_if.h"
@@ -31,7 +33,18 @@
 #include "bsec_interface.h"
 #include "bme680_selftest.h"
 #include "bsec_serialized_configurations_iaq.h"
+#ifdef BSEC_CONFIG_ULP
+#include "bsec_serialized_configurations_iaq_ulp.h"
+#endif
 #include "flashSave.h"
+#include "thOutput.h"
+#include "thHistory.h"
+#include "flashLog.h"
+#include "thStats.h"
+#include "thHid.h"
+#include "thPower.h"
+#include "thClock.h"
+#include "thMsc.h"
 
 #define PUTCHAR_PROTOTYPE int __io_putchar(int ch)
 
@@ -42,6 +55,8 @@ I2C_HandleTypeDef hi2c2;
 
 TIM_HandleTypeDef htim2;
 
+RTC_HandleTypeDef hrtc;
+
 UART_HandleTypeDef huart1;
 /*------------------------*/
 
@@ -52,6 +67,7 @@ void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 static void MX_I2C2_Init(void);
 static void MX_TIM2_Init(void);
+static void MX_RTC_Init(void);
 static void MX_USART1_UART_Init(void);
 static void WatchdogInit(IWDG_HandleTypeDef *watchdogHandle);
 
@@ -59,6 +75,10 @@ void output_ready(int64_t timestamp, float iaq, uint8_t iaq_accuracy, float temp
                   float humidity, float pressure, float raw_temperature, float raw_humidity,
                   float gas, bsec_library_return_t bsec_status, float static_iaq, 
                   float co2_equivalent, float breath_voc_equivalent);
+#ifdef FMT_BENCH
+static void formatBench(const sample_t *sample);
+#endif
+static void reportPending(void);
 int gasSensorInit(struct bme680_dev *gas_sensor);
 int gasSensorConfig(struct bme680_dev *gas_sensor);
 uint32_t config_load(uint8_t *config_buffer, uint32_t n_buffer);
@@ -71,9 +91,26 @@ void user_delay_ms(uint32_t period);
 struct bme680_dev gas_sensor;
 extern configs_t thConfig;
 
-static char outputString[200];
 static uint16_t secCount = 0;
 
+/* Last sample reported, the reference for the deadbands */
+static uint32_t reportedSeq = 0;
+static float reportedValue[FIELD_COUNT];
+/* Last sample queued on the VCP, the catch-up replay goes on from there */
+static uint32_t vcpSeq = 0;
+static bool vcpListening = false;
+/* The last report, for the queues the TIM2 interrupt found claimed by the main loop (it was
+   rendering into them): reportPending() queues it from the main loop once it's done */
+#define REPORT_VCP      0x01
+#define REPORT_VENDOR   0x02
+static volatile uint8_t pendingQueues = 0;
+static uint32_t pendingSeq;               /* the sample, from the history */
+static const stats_t *pendingStats;       /* or the stats window, NULL for a sample */
+static uint32_t sampleSeq = 0;
+/* Last get_timestamp_us() call: the BSEC timestamp and the USB host time then */
+static int64_t stampMicros = -1;
+static hostTime_t stampHostTime;
+
 uint8_t iaqAccuracy = 0;
 bsec_library_return_t bsec_status = BSEC_E_CONFIG_EMPTY;
 
@@ -89,14 +126,20 @@ int main(void)
 
   /* Obtain serial number */
   initConfig(); 
+  /* the HID report descriptor depends on the config, before the USB enumeration */
+  hidInit();
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
   MX_I2C2_Init();
   MX_USB_DEVICE_Init();
   MX_TIM2_Init();
+  MX_RTC_Init();
   MX_USART1_UART_Init();
 
+  /* Find where the sample log left off */
+  flashLogInit();
+
   /* Self-test, it takes ~ 12 seconds */
   int8_t res = gasSensorInit(&gas_sensor);
   if (res == BME680_OK) {UartLog("BME680 initialized.");}
@@ -117,7 +160,11 @@ int main(void)
   WatchdogInit(&watchdogHandle);
 
   UartLog("Initializing BSEC and BME680...");
-  ret = bsec_iot_init(BSEC_SAMPLE_RATE_LP, TEMP_OFFSET, user_i2c_write, user_i2c_read, user_delay_ms, state_load, config_load);
+#ifndef BSEC_CONFIG_ULP
+  /* no ULP configuration in this build */
+  thConfig.sampleRate = SAMPLE_RATE_LP;
+#endif
+  ret = bsec_iot_init((thConfig.sampleRate == SAMPLE_RATE_ULP) ? BSEC_SAMPLE_RATE_ULP : BSEC_SAMPLE_RATE_LP, TEMP_OFFSET, user_i2c_write, user_i2c_read, user_delay_ms, state_load, config_load);
 
   if (ret.bme680_status)
   {
@@ -148,48 +195,84 @@ void output_ready(int64_t timestamp, float iaq, uint8_t iaq_accuracy, float temp
                   float humidity, float pressure, float raw_temperature, float raw_humidity,
                   float gas, bsec_library_return_t _bsec_status, float static_iaq, float co2_equivalent, float breath_voc_equivalent)
 {
+      sample_t *sample = sampleWriteSlot();
+
       iaqAccuracy = iaq_accuracy;
       bsec_status = _bsec_status;
 
-      /* the output will be finally printed by the timer handler... */
-      switch (thConfig.format){
-      case JSON:
-        sprintf(outputString, "{\"temperature\": %.2f, \"pressure\": %.2f, \"humidity\": %.2f, \"gasResistance\": %6.0f, \"IAQ\": %.1f, \"iaqAccuracy\": %u, \"eqCO2\": %.2f, \"eqBreathVOC\": %.2f}\r\n", 
-            temperature,
-            pressure/100, 
-            humidity, 
-            gas,
-            iaq,
-            iaq_accuracy,
-            co2_equivalent,
-            breath_voc_equivalent);  
-        break;
-      case CSV:
-        sprintf(outputString, "%.2f, %.2f, %.2f, %6.0f, %.1f, %u, %.1f, %.2f,\r\n",
-            temperature,
-            pressure/100, 
-            humidity, 
-            gas,
-            iaq,
-            iaq_accuracy,
-            co2_equivalent,
-            breath_voc_equivalent);  
-        break;
-      case HUMAN:
-        sprintf(outputString, "Temperature: %.2f C, Pressure: %.2f hPa, Humidity: %.2f %%rH, Gas resistance: %6.0f ohms, IAQ: %.1f, IAQ Accuracy: %u, CO2equivalent: %.1f, Breath VOC equivalent: % .2f\r\n", 
-            temperature,
-            pressure/100, 
-            humidity, 
-            gas,
-            iaq,
-            iaq_accuracy,
-            co2_equivalent,
-            breath_voc_equivalent);  
-        break;
-      case BINARY:
-        break;  
-    }
+      sample->seq       = ++sampleSeq;
+      sample->timestamp = (uint32_t)(timestamp / 1000000); /* ns -> ms */
+      /* the host time taken along with the BSEC timestamp, the measurement start */
+      if (timestamp / 1000 == stampMicros)
+      {
+        sample->sof = stampHostTime;
+      }
+      else
+      {
+        sample->sof.frame = 0;
+        sample->sof.offset = SOF_OFFSET_INVALID;
+      }
+      sample->fieldMask = thConfig.fieldMask;
+      sample->value[FIELD_TEMPERATURE]    = temperature;
+      sample->value[FIELD_PRESSURE]       = pressure;
+      sample->value[FIELD_HUMIDITY]       = humidity;
+      sample->value[FIELD_GAS_RESISTANCE] = gas;
+      sample->value[FIELD_IAQ]            = iaq;
+      sample->value[FIELD_IAQ_ACCURACY]   = iaq_accuracy;
+      sample->value[FIELD_CO2]            = co2_equivalent;
+      sample->value[FIELD_BREATH_VOC]     = breath_voc_equivalent;
+
+#ifdef FMT_BENCH
+      formatBench(sample);
+#endif
+      /* before the history and the stats window move on */
+      reportPending();
+      historyAdd(sample);
+      flashLogAdd(sample);
+      statsAdd(sample);
+
+      /* the output will be finally serialized and printed by the timer handler... */
+      samplePublish();
+}
+
+#ifdef FMT_BENCH
+/* SysTick based cycle counter (no DWT on the Cortex-M0) */
+static uint32_t cycleCount(void)
+{
+  uint32_t tick, val;
+
+  do {
+    tick = HAL_GetTick();
+    val = SysTick->VAL;
+  } while (tick != HAL_GetTick());
+
+  return tick * (SysTick->LOAD + 1) + (SysTick->LOAD - val);
+}
+
+/* Compares the JSON serialization against the former sprintf path (needs the float printf, see the Makefile) */
+static void formatBench(const sample_t *sample)
+{
+  static char sprintfString[200], fixedString[200];
+  sample_t full = *sample;
+  uint32_t start, sprintfCycles, fixedCycles;
+  int sprintfLength, fixedLength;
+
+  start = cycleCount();
+  sprintfLength = sprintf(sprintfString, "{\"temperature\": %.2f, \"pressure\": %.2f, \"humidity\": %.2f, \"gasResistance\": %6.0f, \"IAQ\": %.1f, \"iaqAccuracy\": %u, \"eqCO2\": %.2f, \"eqBreathVOC\": %.2f}\r\n", 
+      sample->value[FIELD_TEMPERATURE], sample->value[FIELD_PRESSURE]/100, sample->value[FIELD_HUMIDITY], 
+      sample->value[FIELD_GAS_RESISTANCE], sample->value[FIELD_IAQ], (uint8_t)sample->value[FIELD_IAQ_ACCURACY], 
+      sample->value[FIELD_CO2], sample->value[FIELD_BREATH_VOC]);
+  sprintfCycles = cycleCount() - start;
+
+  start = cycleCount();
+  full.fieldMask = FIELD_MASK_ALL;
+  fixedLength = serializeSample(&full, JSON, false, fixedString);
+  fixedCycles = cycleCount() - start;
+
+  UartLog("JSON sprintf: %lu cycles, fixed: %lu cycles, %s", sprintfCycles, fixedCycles, 
+          (sprintfLength == fixedLength && !memcmp(sprintfString, fixedString, fixedLength)) ? "match" : "MISMATCH");
 }
+#endif
 
 /*--------------  BME680 initialization    ------------------------------*/
 int gasSensorInit(struct bme680_dev *gas_sensor)
@@ -248,6 +331,16 @@ uint32_t config_load(uint8_t *config_buffer, uint32_t n_buffer)
     // Return zero if loading was unsuccessful or no config was available,
     // otherwise return length of loaded config string.
     // ...
+    /* the configuration goes with the sample rate (3 s or 300 s) */
+    if (thConfig.sampleRate == SAMPLE_RATE_ULP)
+    {
+#ifdef BSEC_CONFIG_ULP
+        memcpy(config_buffer, bsec_config_iaq_ulp, sizeof(bsec_config_iaq_ulp));
+        return sizeof(bsec_config_iaq_ulp);
+#else
+        return 0;
+#endif
+    }
     memcpy(config_buffer, bsec_config_iaq, sizeof(bsec_config_iaq));
     return sizeof(bsec_config_iaq);
 }
@@ -273,12 +366,37 @@ int8_t user_i2c_write(uint8_t dev_id, uint8_t reg_addr, uint8_t *reg_data, uint1
 
 void user_delay_ms(uint32_t period)
 {
-  HAL_Delay(period);
+  uint32_t start = HAL_GetTick();
+
+  /* the BSEC loop idle time runs the host commands and streams the sample replay, if requested */
+  do
+  {
+    reportPending();
+    processCommands();
+    mscService();
+    if (historyReplayActive())
+    {
+      historyService();
+    }
+    else if (powerSuspended())
+    {
+      /* USB suspended: STOP mode until the next BSEC call is due, or the bus resumes */
+      uint32_t elapsed = HAL_GetTick() - start;
+
+      if (elapsed < period)
+      {
+        powerSleep(period - elapsed);
+      }
+    }
+  } while ((HAL_GetTick() - start) < period);
 }
 
+/* SysTick microseconds, and the USB host time of the same instant for output_ready() */
 int64_t get_timestamp_us(void)
 {
-  return ((int64_t)HAL_GetTick()) * 1000;
+  stampMicros = (int64_t)clockMicros();
+  clockHostTime(&stampHostTime);
+  return stampMicros;
 }
 
 
@@ -292,11 +410,13 @@ void SystemClock_Config(void)
   RCC_OscInitTypeDef RCC_OscInitStruct = {0};
   RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
   RCC_PeriphCLKInitTypeDef PeriphClkInit = {0};
+  RCC_CRSInitTypeDef RCC_CRSInitStruct = {0};
 
   /**Initializes the CPU, AHB and APB busses clocks 
   */
-  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI48;
+  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI48|RCC_OSCILLATORTYPE_LSI;
   RCC_OscInitStruct.HSI48State = RCC_HSI48_ON;
+  RCC_OscInitStruct.LSIState = RCC_LSI_ON;
   RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
@@ -314,14 +434,28 @@ void SystemClock_Config(void)
   {
     Error_Handler();
   }
-  PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_USB|RCC_PERIPHCLK_USART1;
+  PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_USB|RCC_PERIPHCLK_USART1|RCC_PERIPHCLK_RTC;
   PeriphClkInit.Usart1ClockSelection = RCC_USART1CLKSOURCE_PCLK1;
   PeriphClkInit.UsbClockSelection = RCC_USBCLKSOURCE_HSI48;
+  PeriphClkInit.RTCClockSelection = RCC_RTCCLKSOURCE_LSI;
 
   if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK)
   {
     Error_Handler();
   }
+  /**Enable the CRS APB clock 
+  */
+  __HAL_RCC_CRS_CLK_ENABLE();
+  /**Configures CRS: HSI48 trimmed to the USB SOF, the host frames and SysTick then share the time base 
+  */
+  RCC_CRSInitStruct.Prescaler = RCC_CRS_SYNC_DIV1;
+  RCC_CRSInitStruct.Source = RCC_CRS_SYNC_SOURCE_USB;
+  RCC_CRSInitStruct.Polarity = RCC_CRS_SYNC_POLARITY_RISING;
+  RCC_CRSInitStruct.ReloadValue = __HAL_RCC_CRS_RELOADVALUE_CALCULATE(48000000,1000);
+  RCC_CRSInitStruct.ErrorLimitValue = 34;
+  RCC_CRSInitStruct.HSI48CalibrationValue = 32;
+
+  HAL_RCCEx_CRSConfig(&RCC_CRSInitStruct);
 }
 
 /**
@@ -393,6 +527,27 @@ static void MX_TIM2_Init(void)
   HAL_TIM_Base_Start_IT(&htim2);
 }
 
+/**
+  * @brief RTC Initialization Function: a free running LSI cycle counter,
+  *        the wakeup timer ends the STOP mode while the USB is suspended (thPower.c)
+  * @param None
+  * @retval None
+  */
+static void MX_RTC_Init(void)
+{
+  hrtc.Instance = RTC;
+  hrtc.Init.HourFormat = RTC_HOURFORMAT_24;
+  hrtc.Init.AsynchPrediv = 0;
+  hrtc.Init.SynchPrediv = RTC_SYNCH_PREDIV;
+  hrtc.Init.OutPut = RTC_OUTPUT_DISABLE;
+  hrtc.Init.OutPutPolarity = RTC_OUTPUT_POLARITY_HIGH;
+  hrtc.Init.OutPutType = RTC_OUTPUT_TYPE_OPENDRAIN;
+  if (HAL_RTC_Init(&hrtc) != HAL_OK)
+  {
+    Error_Handler();
+  }
+}
+
 /**
   * @brief USART1 Initialization Function
   * @param None
@@ -487,6 +642,148 @@ PUTCHAR_PROTOTYPE
    ----------- IRQ Handlers: -------------------------------------------------
    ---------------------------------------------------------------------------
 */
+/* Follows the VCP host presence (DTR, suspend). When the port opens, the samples missed
+   while it was closed go out first, as a replay, if thConfig.catchUp */
+static void hostCheck(void)
+{
+  bool listening = CDC_HostListening_FS();
+
+  if (listening && !vcpListening && thConfig.catchUp && vcpSeq != 0 &&
+      thConfig.reportMode != REPORT_STATS && !historyReplayActive())
+  {
+    historyReplay(vcpSeq, false);
+  }
+  vcpListening = listening;
+}
+
+/* REPORT_CHANGE: a field moved past its deadband since the last report */
+static bool deadbandExceeded(const sample_t *sample)
+{
+  if (reportedSeq == 0)
+  {
+    return true;
+  }
+  for (uint8_t i = 0; i < FIELD_COUNT; i++)
+  {
+    /* the thresholds are in output units (hPa) */
+    float deadband = thConfig.deadband[i] * fieldTable[i].divisor;
+
+    if (deadband > 0.0f && (sample->fieldMask & (1 << i)) &&
+        fabsf(sample->value[i] - reportedValue[i]) >= deadband)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Binary records for the vendor interface, whatever the VCP format. Dropped while no host reads them */
+static bool vendorReport(const sample_t *sample, const stats_t *stats)
+{
+  uint8_t *frame = VND_TxReserve_FS((stats != NULL) ? STATS_FRAME_MAX_SIZE : BINARY_FRAME_MAX_SIZE);
+
+  if (frame == NULL)
+  {
+    return false;
+  }
+  if (stats != NULL)
+  {
+    VND_TxCommit_FS(serializeStats(stats, BINARY, thConfig.statsLast, (char *)frame));
+  }
+  else
+  {
+    VND_TxCommit_FS(serializeSample(sample, BINARY, false, (char *)frame));
+  }
+  return true;
+}
+
+/* TIM2 interrupt: a queue it couldn't get, the main loop retries once (full queues stay full) */
+static void reportLater(const sample_t *sample, const stats_t *stats, uint8_t queues)
+{
+  if (queues != 0)
+  {
+    pendingSeq = (sample != NULL) ? sample->seq : 0;
+    pendingStats = stats;
+    pendingQueues = queues;
+  }
+}
+
+/* Main loop: the report the TIM2 interrupt left for it, see reportLater() */
+static void reportPending(void)
+{
+  const stats_t *stats;
+  sample_t sample;
+  uint8_t queues;
+  char *dst;
+
+  __disable_irq();
+  queues = pendingQueues;
+  pendingQueues = 0;
+  sample.seq = pendingSeq;
+  stats = pendingStats;
+  __enable_irq();
+
+  if (queues == 0 || (stats == NULL && !historyGet(sample.seq, &sample)))
+  {
+    return;
+  }
+  if (queues & REPORT_VCP)
+  {
+    dst = (char *)CDC_TxReserve_FS((stats != NULL) ? SERIALIZED_STATS_MAX_SIZE : SERIALIZED_SAMPLE_MAX_SIZE);
+    if (dst != NULL && stats != NULL)
+    {
+      CDC_TxCommit_FS(serializeStats(stats, thConfig.format, thConfig.statsLast, dst));
+    }
+    else if (dst != NULL)
+    {
+      CDC_TxCommit_FS(serializeSample(&sample, thConfig.format, false, dst));
+      vcpSeq = sample.seq;
+    }
+  }
+  if (queues & REPORT_VENDOR)
+  {
+    vendorReport((stats != NULL) ? NULL : &sample, stats);
+  }
+}
+
+/* Serialized straight into the USB TX queues. False if both are full, the sample isn't reported.
+   A queue the main loop holds gets it later, from reportPending() */
+static bool reportSample(const sample_t *sample)
+{
+  /* nobody has the port open: not even serialized, the sample is in the history */
+  char *dst = vcpListening ? (char *)CDC_TxReserve_FS(SERIALIZED_SAMPLE_MAX_SIZE) : NULL;
+  bool reported = (dst != NULL);
+  uint8_t missed = 0;
+
+  if (reported)
+  {
+    CDC_TxCommit_FS(serializeSample(sample, thConfig.format, false, dst));
+    vcpSeq = sample->seq;
+  }
+  else if (vcpListening)
+  {
+    missed |= REPORT_VCP;
+  }
+  /* the vendor copy goes out even with the VCP queue full (tty not open) */
+  if (vendorReport(sample, NULL))
+  {
+    reported = true;
+  }
+  else
+  {
+    missed |= REPORT_VENDOR;
+  }
+  reportLater(sample, NULL, missed);
+  if (!reported && !(missed & REPORT_VCP))
+  {
+    return false;
+  }
+
+  reportedSeq = sample->seq;
+  memcpy(reportedValue, sample->value, sizeof(reportedValue));
+  return true;
+}
+
 /**
   * @brief  Period elapsed callback in non blocking mode
   * @param  htim : TIM handle
@@ -494,8 +791,8 @@ PUTCHAR_PROTOTYPE
   */
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
-  /* Blink blue LED until BSEC give us a valid IAQ value, ~5 minutes */
-  if (thConfig.ledEnabled){
+  /* Blink blue LED until BSEC give us a valid IAQ value, ~5 minutes. Off while suspended */
+  if (thConfig.ledEnabled && !powerSuspended()){
     if (iaqAccuracy == 0){  
       HAL_GPIO_TogglePin(GPIOB, BLUE_LED_Pin);  
     } 
@@ -507,10 +804,50 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
     /* Disable Blue LED */
     HAL_GPIO_WritePin(BLUE_LED_GPIO_Port, BLUE_LED_Pin, GPIO_PIN_SET);
   }
+  /* HID input reports have their own interval */
+  hidTick();
+  hostCheck();
   if (++secCount >= thConfig.reportingPeriod && bsec_status == BSEC_OK)
   {
+    /* the main loop can't run until we return, the published sample is stable */
+    const sample_t *sample = sampleLatest();
+    const stats_t *stats;
+
     secCount = 0;
-    uprintf(outputString);
+    /* no live reports while replaying, they are part of the replay (the stats window goes on) */
+    if (historyReplayActive()) {
+      return;
+    }
+    /* a new window every period, whatever the report mode */
+    stats = statsClose();
+    if (thConfig.reportMode == REPORT_STATS) {
+      char *dst = (stats != NULL && vcpListening) ? (char *)CDC_TxReserve_FS(SERIALIZED_STATS_MAX_SIZE) : NULL;
+      uint8_t missed = 0;
+
+      if (dst != NULL) {
+        CDC_TxCommit_FS(serializeStats(stats, thConfig.format, thConfig.statsLast, dst));
+      } else if (stats != NULL && vcpListening) {
+        missed |= REPORT_VCP;
+      }
+      if (stats != NULL && !vendorReport(NULL, stats)) {
+        missed |= REPORT_VENDOR;
+      }
+      reportLater(NULL, stats, missed);
+    } else if (sample != NULL) {
+      /* REPORT_CHANGE too, as the heartbeat */
+      reportSample(sample);
+    }
+  }
+  else if (thConfig.reportMode == REPORT_CHANGE && bsec_status == BSEC_OK)
+  {
+    /* between heartbeats, checked every second: a new sample past a deadband goes out now */
+    const sample_t *sample = sampleLatest();
+
+    if (sample != NULL && sample->seq != reportedSeq && !historyReplayActive() &&
+        deadbandExceeded(sample) && reportSample(sample))
+    {
+      secCount = 0;
+    }
   }
 }
 
@@ -5,10 +5,10 @@
 #include "thBsec.h"
 #include "main.h"
 #include "thConfig.h"
+#include "thOutput.h"
+#include "thPower.h"
 extern configs_t thConfig;
 
-#define NUM_USED_OUTPUTS 10
-
 extern IWDG_HandleTypeDef   watchdogHandle;
 
 /* Global sensor APIs data structure */
@@ -16,47 +16,74 @@ static struct bme680_dev bme680_g;
 
 /* Global temperature offset to be subtracted */
 static float bme680_temperature_offset_g = 0.0f;
+/* Device self-heating, LP only: it's negligible in ULP */
+static float bme680_self_heating_g = 0.0f;
+
+/* Sample rate and output fields of the current subscription */
+static float bsec_sample_rate_g = BSEC_SAMPLE_RATE_LP;
+static uint8_t bsec_sample_mode_g = SAMPLE_RATE_LP;
+static uint16_t bsec_field_mask_g = 0;
+
+/* For the configuration of a new sample rate, see config_load() */
+static config_load_fct bsec_config_load_g;
+
+/* An on demand measurement was asked for (ULP) */
+static volatile bool bsec_measure_g = false;
+
+/* State transfer buffer, words: state_save() reads it 4 bytes at a time */
+static uint32_t bsec_xfer_state_g[(BSEC_MAX_STATE_BLOB_SIZE + 3) / 4];
+static uint16_t bsec_xfer_len_g = 0;
+static uint16_t bsec_xfer_crc_g = 0;
+static volatile uint8_t bsec_xfer_g = STATE_XFER_IDLE;
+
+#define bsec_xfer_pending()     (bsec_xfer_g == STATE_XFER_EXPORT || bsec_xfer_g == STATE_XFER_IMPORT)
+
+/* Work buffer of the BSEC calls that take one, static: it's too large for the stack. The calls
+   all come from bsec_iot_init() and then bsec_iot_loop(), one at a time */
+static uint8_t bsec_work_buffer_g[BSEC_MAX_WORKBUFFER_SIZE];
 
 /*!
  * @brief        Virtual sensor subscription
  *               Please call this function before processing of data using bsec_do_steps function
  *
  * @param[in]    sample_rate         mode to be used (either BSEC_SAMPLE_RATE_ULP or BSEC_SAMPLE_RATE_LP)
+ * @param[in]    field_mask          output fields (thOutput.h), the virtual sensors of the other ones are disabled
  *  
  * @return       subscription result, zero when successful
  */
-static bsec_library_return_t bme680_bsec_update_subscription(float sample_rate)
+static bsec_library_return_t bme680_bsec_update_subscription(float sample_rate, uint16_t field_mask)
 {
-    bsec_sensor_configuration_t requested_virtual_sensors[NUM_USED_OUTPUTS];
-    uint8_t n_requested_virtual_sensors = NUM_USED_OUTPUTS;
+    bsec_sensor_configuration_t requested_virtual_sensors[FIELD_COUNT];
+    uint8_t n_requested_virtual_sensors = 0;
     
     bsec_sensor_configuration_t required_sensor_settings[BSEC_MAX_PHYSICAL_SENSOR];
     uint8_t n_required_sensor_settings = BSEC_MAX_PHYSICAL_SENSOR;
     
     bsec_library_return_t status = BSEC_OK;
+    uint8_t field, index;
     
-    /* note: Virtual sensors as desired to be added here */
-    requested_virtual_sensors[0].sensor_id = BSEC_OUTPUT_IAQ;
-    requested_virtual_sensors[0].sample_rate = sample_rate;
-    requested_virtual_sensors[1].sensor_id = BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE;
-    requested_virtual_sensors[1].sample_rate = sample_rate;
-    requested_virtual_sensors[2].sensor_id = BSEC_OUTPUT_RAW_PRESSURE;
-    requested_virtual_sensors[2].sample_rate = sample_rate;
-    requested_virtual_sensors[3].sensor_id = BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY;
-    requested_virtual_sensors[3].sample_rate = sample_rate;
-    requested_virtual_sensors[4].sensor_id = BSEC_OUTPUT_RAW_GAS;
-    requested_virtual_sensors[4].sample_rate = sample_rate;
-    requested_virtual_sensors[5].sensor_id = BSEC_OUTPUT_RAW_TEMPERATURE;
-    requested_virtual_sensors[5].sample_rate = sample_rate;
-    requested_virtual_sensors[6].sensor_id = BSEC_OUTPUT_RAW_HUMIDITY;
-    requested_virtual_sensors[6].sample_rate = sample_rate;
-    requested_virtual_sensors[7].sensor_id = BSEC_OUTPUT_STATIC_IAQ;
-    requested_virtual_sensors[7].sample_rate = sample_rate;
+    /* One virtual sensor per output field (some fields share the same one, i.e. IAQ and its accuracy) */
+    for (field = 0; field < FIELD_COUNT; field++)
+    {
+        for (index = 0; index < n_requested_virtual_sensors; index++)
+        {
+            if (requested_virtual_sensors[index].sensor_id == fieldTable[field].bsecId)
+            {
+                break;
+            }
+        }
+        if (index == n_requested_virtual_sensors)
+        {
+            requested_virtual_sensors[index].sensor_id = fieldTable[field].bsecId;
+            requested_virtual_sensors[index].sample_rate = BSEC_SAMPLE_RATE_DISABLED;
+            n_requested_virtual_sensors++;
+        }
+        if (field_mask & (1 << field))
+        {
+            requested_virtual_sensors[index].sample_rate = sample_rate;
+        }
+    }
     
-    requested_virtual_sensors[8].sensor_id = BSEC_OUTPUT_BREATH_VOC_EQUIVALENT;
-    requested_virtual_sensors[8].sample_rate = sample_rate;
-    requested_virtual_sensors[9].sensor_id = BSEC_OUTPUT_CO2_EQUIVALENT;
-    requested_virtual_sensors[9].sample_rate = sample_rate;
     /* Call bsec_update_subscription() to enable/disable the requested virtual sensors */
     status = bsec_update_subscription(requested_virtual_sensors, n_requested_virtual_sensors, required_sensor_settings,
         &n_required_sensor_settings);
@@ -64,6 +91,160 @@ static bsec_library_return_t bme680_bsec_update_subscription(float sample_rate)
     return status;
 }
 
+/*!
+ * @brief       Switches to the sample rate of thConfig.sampleRate. The state goes through the
+ *              configuration change, so the calibration is kept. Back to LP if BSEC refuses it
+ *
+ * @param[out]  bsec_state          scratch buffer for the state, BSEC_MAX_STATE_BLOB_SIZE bytes
+ *
+ * @return      subscription result, zero when successful
+ */
+static bsec_library_return_t bme680_bsec_set_sample_rate(uint8_t *bsec_state)
+{
+    uint8_t bsec_config[BSEC_MAX_PROPERTY_BLOB_SIZE];
+    uint32_t bsec_state_len = 0;
+    uint32_t bsec_config_len;
+    bsec_library_return_t status;
+
+    status = bsec_get_state(0, bsec_state, BSEC_MAX_STATE_BLOB_SIZE, bsec_work_buffer_g, sizeof(bsec_work_buffer_g),
+        &bsec_state_len);
+    if (status != BSEC_OK)
+    {
+        bsec_state_len = 0;
+    }
+
+    /* at most twice: the mode asked for, then LP in the same frame */
+    while (1)
+    {
+        bsec_config_len = bsec_config_load_g(bsec_config, sizeof(bsec_config));
+        if (bsec_config_len == 0 && thConfig.sampleRate != SAMPLE_RATE_LP)
+        {
+            UartLog("BSEC: no configuration for sample rate %u, back to LP", thConfig.sampleRate);
+            thConfig.sampleRate = SAMPLE_RATE_LP;
+            continue;
+        }
+        if (bsec_config_len != 0)
+        {
+            bsec_set_configuration(bsec_config, bsec_config_len, bsec_work_buffer_g, sizeof(bsec_work_buffer_g));
+        }
+        if (bsec_state_len != 0)
+        {
+            bsec_set_state(bsec_state, bsec_state_len, bsec_work_buffer_g, sizeof(bsec_work_buffer_g));
+        }
+
+        bsec_sample_mode_g = thConfig.sampleRate;
+        bsec_sample_rate_g = (bsec_sample_mode_g == SAMPLE_RATE_ULP) ? BSEC_SAMPLE_RATE_ULP : BSEC_SAMPLE_RATE_LP;
+        bme680_temperature_offset_g = ((bsec_sample_mode_g == SAMPLE_RATE_ULP) ? 0.0f : bme680_self_heating_g) + thConfig.temperatureOffset;
+
+        status = bme680_bsec_update_subscription(bsec_sample_rate_g, bsec_field_mask_g);
+        if (status < BSEC_OK && bsec_sample_mode_g != SAMPLE_RATE_LP)
+        {
+            UartLog("BSEC: sample rate %u refused (%d), back to LP", bsec_sample_mode_g, status);
+            thConfig.sampleRate = SAMPLE_RATE_LP;
+            continue;
+        }
+        return status;
+    }
+}
+
+/*!
+ * @brief       Asks for one more sample as soon as BSEC allows it (ULP plus), ignored in LP
+ *
+ * @return      none
+ */
+void bsec_iot_measure(void)
+{
+    bsec_measure_g = true;
+}
+
+void bsec_iot_state_export(void)
+{
+    bsec_xfer_g = STATE_XFER_EXPORT;
+}
+
+bool bsec_iot_state_import(uint16_t len, uint16_t crc)
+{
+    if (len == 0 || len > BSEC_MAX_STATE_BLOB_SIZE)
+    {
+        return false;
+    }
+    bsec_xfer_len_g = len;
+    bsec_xfer_crc_g = crc;
+    bsec_xfer_g = STATE_XFER_IMPORT;
+    return true;
+}
+
+void bsec_iot_state_read(uint16_t offset, uint8_t *dst, uint16_t len)
+{
+    const uint8_t *state = (const uint8_t *)bsec_xfer_state_g;
+    uint16_t end = (bsec_xfer_g == STATE_XFER_EXPORTED) ? bsec_xfer_len_g : 0;
+
+    for (uint16_t n = 0; n < len; n++, offset++)
+    {
+        dst[n] = (offset < end) ? state[offset] : 0;
+    }
+}
+
+void bsec_iot_state_write(uint16_t offset, const uint8_t *src, uint16_t len)
+{
+    uint8_t *state = (uint8_t *)bsec_xfer_state_g;
+
+    bsec_xfer_g = STATE_XFER_IDLE;
+    for (uint16_t n = 0; n < len && offset < BSEC_MAX_STATE_BLOB_SIZE; n++, offset++)
+    {
+        state[offset] = src[n];
+    }
+}
+
+uint8_t bsec_iot_state_status(uint16_t *len, uint16_t *crc)
+{
+    uint8_t status = bsec_xfer_g;
+
+    *len = (status == STATE_XFER_EXPORTED || status == STATE_XFER_IMPORTED) ? bsec_xfer_len_g : 0;
+    *crc = (*len != 0) ? bsec_xfer_crc_g : 0;
+    return status;
+}
+
+/*!
+ * @brief       Runs the state transfer asked for, the BSEC loop calls it between two samples
+ *
+ * @param[in]   state_save          pointer to the system-specific state save function
+ *
+ * @return      none
+ */
+static void bme680_bsec_state_transfer(state_save_fct state_save)
+{
+    uint8_t *state = (uint8_t *)bsec_xfer_state_g;
+    uint32_t state_len = 0;
+
+    if (bsec_xfer_g == STATE_XFER_EXPORT)
+    {
+        if (bsec_get_state(0, state, BSEC_MAX_STATE_BLOB_SIZE, bsec_work_buffer_g, sizeof(bsec_work_buffer_g),
+                &state_len) != BSEC_OK ||
+            state_len == 0)
+        {
+            bsec_xfer_g = STATE_XFER_FAILED;
+            return;
+        }
+        bsec_xfer_len_g = state_len;
+        bsec_xfer_crc_g = crc16(state, state_len);
+        bsec_xfer_g = STATE_XFER_EXPORTED;
+    }
+    else if (bsec_xfer_g == STATE_XFER_IMPORT)
+    {
+        if (crc16(state, bsec_xfer_len_g) != bsec_xfer_crc_g ||
+            bsec_set_state(state, bsec_xfer_len_g, bsec_work_buffer_g, sizeof(bsec_work_buffer_g)) != BSEC_OK)
+        {
+            UartLog("BSEC: state import refused");
+            bsec_xfer_g = STATE_XFER_FAILED;
+            return;
+        }
+        /* kept over a reset too */
+        state_save(state, bsec_xfer_len_g);
+        bsec_xfer_g = STATE_XFER_IMPORTED;
+    }
+}
+
 /*!
  * @brief       Initialize the BME680 sensor and the BSEC library
  *
@@ -83,9 +264,9 @@ return_values_init bsec_iot_init(float sample_rate, float temperature_offset, bm
     return_values_init ret = {BME680_OK, BSEC_OK};
     bsec_library_return_t bsec_status = BSEC_OK;
     
-    uint8_t bsec_state[BSEC_MAX_PROPERTY_BLOB_SIZE] = {0};
+    /* the state transfer buffer, idle until the loop runs: word aligned as state_load() wants */
+    uint8_t *bsec_state = (uint8_t *)bsec_xfer_state_g;
     uint8_t bsec_config[BSEC_MAX_PROPERTY_BLOB_SIZE] = {0};
-    uint8_t work_buffer[BSEC_MAX_WORKBUFFER_SIZE] = {0};
     int bsec_state_len, bsec_config_len;
     
     /* Fixed I2C configuration */
@@ -114,7 +295,7 @@ return_values_init bsec_iot_init(float sample_rate, float temperature_offset, bm
     bsec_config_len = config_load(bsec_config, sizeof(bsec_config));
     if (bsec_config_len != 0)
     {       
-        ret.bsec_status = bsec_set_configuration(bsec_config, bsec_config_len, work_buffer, sizeof(work_buffer));     
+        ret.bsec_status = bsec_set_configuration(bsec_config, bsec_config_len, bsec_work_buffer_g, sizeof(bsec_work_buffer_g));     
         if (ret.bsec_status != BSEC_OK)
         {
             return ret;
@@ -122,10 +303,10 @@ return_values_init bsec_iot_init(float sample_rate, float temperature_offset, bm
     }
     
     // /* Load previous library state, if available */
-    bsec_state_len = state_load(bsec_state, sizeof(bsec_state));
+    bsec_state_len = state_load(bsec_state, sizeof(bsec_xfer_state_g));
     if (bsec_state_len != 0)
     {       
-        ret.bsec_status = bsec_set_state(bsec_state, bsec_state_len, work_buffer, sizeof(work_buffer));     
+        ret.bsec_status = bsec_set_state(bsec_state, bsec_state_len, bsec_work_buffer_g, sizeof(bsec_work_buffer_g));     
         if (ret.bsec_status != BSEC_OK)
         {
             return ret;
@@ -134,10 +315,15 @@ return_values_init bsec_iot_init(float sample_rate, float temperature_offset, bm
     
     /* Set temperature offset */
     // bme680_temperature_offset_g = temperature_offset;
-    bme680_temperature_offset_g = temperature_offset + thConfig.temperatureOffset;
+    bme680_self_heating_g = temperature_offset;
+    bme680_temperature_offset_g = ((sample_rate == BSEC_SAMPLE_RATE_ULP) ? 0.0f : temperature_offset) + thConfig.temperatureOffset;
+    bsec_config_load_g = config_load;
     
     /* Call to the function which sets the library with subscription information */
-    ret.bsec_status = bme680_bsec_update_subscription(sample_rate);
+    bsec_sample_rate_g = sample_rate;
+    bsec_sample_mode_g = (sample_rate == BSEC_SAMPLE_RATE_ULP) ? SAMPLE_RATE_ULP : SAMPLE_RATE_LP;
+    bsec_field_mask_g = thConfig.fieldMask;
+    ret.bsec_status = bme680_bsec_update_subscription(bsec_sample_rate_g, bsec_field_mask_g);
     if (ret.bsec_status != BSEC_OK)
     {
         return ret;
@@ -428,7 +614,6 @@ void bsec_iot_loop(sleep_fct sleep, get_timestamp_us_fct get_timestamp_us, outpu
     
     /* Save state variables */
     uint8_t bsec_state[BSEC_MAX_STATE_BLOB_SIZE];
-    uint8_t work_buffer[BSEC_MAX_STATE_BLOB_SIZE];
     uint32_t bsec_state_len = 0;
     uint32_t n_samples = 0;
     
@@ -436,6 +621,45 @@ void bsec_iot_loop(sleep_fct sleep, get_timestamp_us_fct get_timestamp_us, outpu
 
     while (1)
     {
+        /* State export or import, between two samples as the other BSEC calls */
+        if (bsec_xfer_pending())
+        {
+            bme680_bsec_state_transfer(state_save);
+        }
+
+        /* The field mask or the sample rate changed (command interface), apply it between two samples */
+        if (bsec_sample_mode_g != thConfig.sampleRate)
+        {
+            bsec_field_mask_g = thConfig.fieldMask;
+            bme680_bsec_set_sample_rate(bsec_state);
+        }
+        else if (bsec_field_mask_g != thConfig.fieldMask)
+        {
+            bsec_status = bme680_bsec_update_subscription(bsec_sample_rate_g, thConfig.fieldMask);
+            if (bsec_status < BSEC_OK)
+            {
+                /* refused: back to the fields BSEC still delivers, the status shows them */
+                UartLog("BSEC: subscription of fields 0x%x refused (%d)", thConfig.fieldMask, bsec_status);
+                thConfig.fieldMask = bsec_field_mask_g;
+                bme680_bsec_update_subscription(bsec_sample_rate_g, bsec_field_mask_g);
+            }
+            bsec_field_mask_g = thConfig.fieldMask;
+        }
+
+        /* ULP plus: a measurement now, then ULP goes on */
+        if (bsec_measure_g)
+        {
+            bsec_measure_g = false;
+            if (bsec_sample_mode_g == SAMPLE_RATE_ULP)
+            {
+                bsec_status = bme680_bsec_update_subscription(BSEC_SAMPLE_RATE_ULP_MEASUREMENT_ON_DEMAND, bsec_field_mask_g);
+                if (bsec_status < BSEC_OK)
+                {
+                    UartLog("BSEC: measurement on demand refused (%d)", bsec_status);
+                }
+            }
+        }
+
         /* get the timestamp in nanoseconds before calling bsec_sensor_control() */
         time_stamp = get_timestamp_us() * 1000;
         
@@ -452,13 +676,14 @@ void bsec_iot_loop(sleep_fct sleep, get_timestamp_us_fct get_timestamp_us, outpu
         /* Time to invoke BSEC to perform the actual processing */
         bme680_bsec_process_data(bsec_inputs, num_bsec_inputs, output_ready);
         
-        /* Increment sample counter */
-        n_samples++;
+        /* Increment sample counter, a ULP sample counts for the 100 LP ones it takes the place of */
+        n_samples += (bsec_sample_mode_g == SAMPLE_RATE_ULP) ? 100 : 1;
         
         /* Retrieve and store state if the passed save_intvl */
         if (n_samples >= save_intvl)
         {
-            bsec_status = bsec_get_state(0, bsec_state, sizeof(bsec_state), work_buffer, sizeof(work_buffer), &bsec_state_len);
+            bsec_status = bsec_get_state(0, bsec_state, sizeof(bsec_state), bsec_work_buffer_g, sizeof(bsec_work_buffer_g),
+                &bsec_state_len);
             if (bsec_status == BSEC_OK)
             {
                 state_save(bsec_state, bsec_state_len);
@@ -466,7 +691,7 @@ void bsec_iot_loop(sleep_fct sleep, get_timestamp_us_fct get_timestamp_us, outpu
             n_samples = 0;
         }
 
-        if (thConfig.ledEnabled){
+        if (thConfig.ledEnabled && !powerSuspended()){
             HAL_GPIO_WritePin(RED_LED_GPIO_Port, RED_LED_Pin, 0);
             HAL_Delay(75);
             HAL_GPIO_WritePin(RED_LED_GPIO_Port, RED_LED_Pin, 1);
@@ -478,10 +703,14 @@ void bsec_iot_loop(sleep_fct sleep, get_timestamp_us_fct get_timestamp_us, outpu
         
         /* Compute how long we can sleep until we need to call bsec_sensor_control() next */
         /* Time_stamp is converted from microseconds to nanoseconds first and then the difference to milliseconds */
+        /* In slices: a new sample rate, a measurement request or a state transfer doesn't wait for the end of a ULP period */
         time_stamp_interval_ms = (sensor_settings.next_call - get_timestamp_us() * 1000) / 1000000;
-        if (time_stamp_interval_ms > 0)
+        while (time_stamp_interval_ms > 0 && bsec_sample_mode_g == thConfig.sampleRate && !bsec_measure_g &&
+            !bsec_xfer_pending())
         {
-            sleep((uint32_t)time_stamp_interval_ms);
+            sleep((time_stamp_interval_ms > 1000) ? 1000 : (uint32_t)time_stamp_interval_ms);
+            HAL_IWDG_Refresh(&watchdogHandle);
+            time_stamp_interval_ms = (sensor_settings.next_call - get_timestamp_us() * 1000) / 1000000;
         }
     }
 }
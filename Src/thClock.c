@@ -0,0 +1,128 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+#include "thClock.h"
+
+/* SOF reference: the last capture that came in time, see clockSof() */
+static volatile uint32_t refFrame;
+static volatile uint32_t refCycles;
+static volatile bool refValid = false;
+
+/* last SOF seen, frame number extended to 32 bits */
+static uint32_t sofFrame;
+static uint32_t sofCycles;
+static uint16_t sofFn;
+static bool sofStarted = false;
+
+/* uwTick and the SysTick counter, consistent. Safe from any interrupt handler: a SysTick
+   reload not yet counted in uwTick (handler pending) is added here */
+static void tickRead(uint32_t *tick, uint32_t *val)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	*tick = HAL_GetTick();
+	*val = SysTick->VAL;
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+		/* reloaded, maybe just after the first read: read it again on this side */
+		*val = SysTick->VAL;
+		(*tick)++;
+	}
+	__set_PRIMASK(primask);
+}
+
+/* SysTick cycles since boot, wraps every ~89 s at 48 MHz */
+static uint32_t clockCycles(void)
+{
+	uint32_t tick, val;
+
+	tickRead(&tick, &val);
+	return tick * (SysTick->LOAD + 1) + (SysTick->LOAD - val);
+}
+
+/* Called by the USB interrupt on every SOF. The capture is late whenever another handler
+   was running (the TIM2 reporter can take a few hundred us), so it only becomes the
+   reference when the interval to the previous SOF matches the frame count: both in time */
+void clockSof(void)
+{
+	uint32_t cycles = clockCycles();
+	uint16_t fn = USB->FNR & USB_FNR_FN;
+	uint32_t frames = (fn - sofFn) & USB_FNR_FN;
+	uint32_t expected = frames * (SysTick->LOAD + 1);
+	uint32_t interval = cycles - sofCycles;
+
+	if (!sofStarted) {
+		sofStarted = true;
+		sofFrame = fn;
+		frames = 0;
+	}
+	sofFrame += frames;
+	sofFn = fn;
+	sofCycles = cycles;
+
+	if (frames && frames <= SOF_MAX_AGE_MS &&
+			interval + SOF_TOLERANCE_CYCLES >= expected && interval <= expected + SOF_TOLERANCE_CYCLES) {
+		refFrame = sofFrame;
+		refCycles = cycles;
+		refValid = true;
+	}
+}
+
+/* Microseconds since boot, the BSEC time base */
+uint64_t clockMicros(void)
+{
+	uint32_t tick, val;
+
+	tickRead(&tick, &val);
+	return (uint64_t)tick * 1000 + (SysTick->LOAD - val) / ((SysTick->LOAD + 1) / 1000);
+}
+
+/* The current time as the host sees it: the last SOF reference plus the SysTick time since.
+   HSI48 is trimmed to the SOF by the CRS, so SysTick and the frames run at the same rate */
+bool clockHostTime(hostTime_t *time)
+{
+	uint32_t perFrame = SysTick->LOAD + 1;
+	uint32_t primask = __get_PRIMASK();
+	uint32_t cycles, frame, ref, elapsed;
+	bool valid;
+
+	__disable_irq();
+	cycles = clockCycles();
+	frame = refFrame;
+	ref = refCycles;
+	valid = refValid;
+	__set_PRIMASK(primask);
+
+	elapsed = cycles - ref;
+	if (!valid || elapsed >= SOF_MAX_AGE_MS * perFrame) {
+		time->frame = 0;
+		time->offset = SOF_OFFSET_INVALID;
+		return false;
+	}
+	time->frame = frame + elapsed / perFrame;
+	time->offset = (elapsed % perFrame) / (perFrame / 1000);
+	return true;
+}
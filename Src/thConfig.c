@@ -22,15 +22,25 @@
 * SOFTWARE.     
 ****************************************************************************/
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include "thConfig.h"
 #include "main.h" //for the UART_LOG
 #include "usbd_cdc_if.h"
 #include "version.h"
-#include "jsmn.h"
+#include "jsonStream.h"
 #include "flashSave.h"
+#include "thOutput.h"
+#include "thHistory.h"
+#include "flashLog.h"
+#include "thHid.h"
+#include "thCommands.h"
+#include "thProto.h"
+#include "thBsec.h"
 
 
 
@@ -39,13 +49,27 @@ configs_t thConfig = { .format = JSON,
 					 .reportingPeriod 	 = 3, /*default*/
 					 .ledEnabled		 = true,
 					 .temperatureOffset  = 0,
+					 .fieldMask			 = FIELD_MASK_ALL,
+					 .deadband			 = { [FIELD_IAQ] = 5.0f, [FIELD_CO2] = 50.0f },
+					 .hidInterval		 = 3000,
+					 .hidValueSize		 = 2,
 					};
 
 
 static const char *FORMAT_STRING[] = {
-    "JSON", "HUMAN", "CSV", "BINARY",
+    "JSON", "HUMAN", "CSV", "BINARY", "CBOR",
 };
 
+static const char *REPORT_STRING[] = {
+    "last", "stats", "change",
+};
+
+static const char *SAMPLE_RATE_STRING[] = {
+    "LP", "ULP",
+};
+
+_Static_assert(sizeof(thConfig.deadband) / sizeof(thConfig.deadband[0]) == FIELD_COUNT, "one deadband per field");
+
 static const char *HW_ID = { "uThing::VOC rev.A"};
 
 static const char *PERIOD_STRING[] = {
@@ -60,15 +84,77 @@ static const char *PERIOD_STRING[] = {
 
 static uint32_t hash32(uint32_t a);
 static void processChar(uint8_t input);
-static int processJson(const char *buffer);
-static int jsoneq(const char *json, jsmntok_t *tok, const char *s);
+static int jsoneqNoCase(const char *json, const jsmntok_t *tok, const char *s);
+static uint8_t jsonField(const char *json, const jsmntok_t *tok);
+static uint16_t jsonFieldMask(const char *json, const jsmntok_t *tok);
+static int jsonSkip(const jsmntok_t *tok);
+static void jsonDeadband(const char *json, const jsmntok_t *tok);
 static void jsonPrintStatus(void);
 static char toUpperCase(const char ch);
 static void jsonPrintDevInfo(void);
+static void processInput(shellBuffer_t *input);
+static void shellPutChar(shellBuffer_t *input, uint8_t rxChar);
+
+/* A JSON command source: its reader and the object it's running */
+typedef struct {
+	jsonStream_t json;
+	bool staged;		/* the object has members in jsonObject, it fails if another source took it */
+} shellJson_t;
+
+static uint8_t shellJsonPut(shellJson_t *sh, char c);
+static bool vendorPut(uint8_t byte);
+
+/* uprintf() longest output */
+#define UPRINTF_MAX_SIZE	512
+/* the CDC data interface line being typed, filled from the RX ring */
+static shellBuffer_t shellBuffer;
+/* JSON objects, read as the bytes come from the CDC RX ring or the vendor OUT endpoint.
+   A member at a time, in one buffer for both (see jsonStream.h) */
+static jsonMember_t jsonMember;
+static shellJson_t cdcJson = { .json.member = &jsonMember };
+static shellJson_t vendorJson = { .json.member = &jsonMember };
+/* bytes of the vendor OUT packet already parsed */
+static uint16_t vendorPos = 0;
+
+/* The object being run takes effect as a whole once it's closed without error, as a binary
+   request (thProto.c): the settings go to jsonConfig, a copy of thConfig, and the actions
+   (replies, replay, measure) wait. Shared by the sources as the member buffer, one starting
+   an object while another is in the middle of one takes it, the interrupted object fails */
+#define JSON_ACTIONS_MAX	4
+static configs_t jsonConfig;
+static struct {
+	const shellJson_t *owner;
+	uint16_t changed;		/* configFields[] the object wrote */
+	bool save;				/* a saveConfig key */
+	uint8_t actions;		/* more are ignored */
+	struct {
+		const command_t *cmd;
+		uint32_t u;
+	} action[JSON_ACTIONS_MAX];
+} jsonObject;
+
+/* The fields of configs_t, written back one by one: the BSEC loop and the binary protocol
+   may change the others while an object is being read */
+#define CONFIG_FIELD(name)	{ offsetof(configs_t, name), sizeof(((configs_t *)0)->name) }
+static const struct {
+	uint8_t offset;
+	uint8_t size;
+} configFields[] = {
+	CONFIG_FIELD(reportingPeriodIdx), CONFIG_FIELD(reportingPeriod), CONFIG_FIELD(ledEnabled),
+	CONFIG_FIELD(format), CONFIG_FIELD(serialNumberStr), CONFIG_FIELD(temperatureOffset),
+	CONFIG_FIELD(fieldMask), CONFIG_FIELD(logPeriod), CONFIG_FIELD(reportMode),
+	CONFIG_FIELD(statsLast), CONFIG_FIELD(deadband), CONFIG_FIELD(hidInterval),
+	CONFIG_FIELD(hidValueSize), CONFIG_FIELD(catchUp), CONFIG_FIELD(sampleRate),
+};
+_Static_assert(sizeof(configFields) / sizeof(configFields[0]) <= 16, "jsonObject.changed is 16 bits");
 
-#define outBufferSize 	512
-static char outBuffer[outBufferSize];
-shellBuffer_t shellBuffer;
+/* Set while a vendor interface command runs: ureserve()/ucommit() send the replies there, as
+   [COBS(RECORD_TYPE_TEXT, text, CRC16)] [0x00] frames. The text is rendered TEXT_FRAME_HEADROOM
+   bytes into the reservation and framed in place (see binaryFrame()) */
+static bool replyVendor = false;
+static uint8_t *textFrame;
+#define TEXT_FRAME_HEADROOM	4
+#define TEXT_FRAME_EXTRA	8	/* headroom, type, CRC, COBS overhead and delimiter up to 760 bytes */
 
 
 /* Obtain the serial number from the MCU UID */
@@ -86,66 +172,225 @@ void initConfig(void)
 
 	/* Load config from Flash if available, otherwise keep default*/
 	loadConfig(&thConfig);
+
+	thConfig.fieldMask &= FIELD_MASK_ALL;
+	if (thConfig.fieldMask == 0) {
+		thConfig.fieldMask = FIELD_MASK_ALL;
+	}
+	if (thConfig.logPeriod != 0 && thConfig.logPeriod < LOG_PERIOD_MIN) {
+		thConfig.logPeriod = LOG_PERIOD_MIN;
+	}
+	if (thConfig.reportMode >= REPORT_MODES) {
+		thConfig.reportMode = REPORT_LAST;
+	}
+	if (thConfig.hidInterval != 0 && thConfig.hidInterval < HID_INTERVAL_MIN) {
+		thConfig.hidInterval = HID_INTERVAL_MIN;
+	} else if (thConfig.hidInterval > HID_INTERVAL_MAX) {
+		thConfig.hidInterval = HID_INTERVAL_MAX;
+	}
+	if (thConfig.hidValueSize != 4) {
+		thConfig.hidValueSize = 2;
+	}
+	if (thConfig.sampleRate >= SAMPLE_RATE_MODES) {
+		thConfig.sampleRate = SAMPLE_RATE_LP;
+	}
 }
 
 
+/* Formatted straight into the USB TX queue */
 int uprintf(const char *format, ...)
 {
 	va_list arguments;
+	char *dst = ureserve(UPRINTF_MAX_SIZE);
+
+	if (dst == NULL) {
+		return 0;
+	}
 
 	va_start(arguments, format);
 
-	int len = vsprintf(outBuffer, format, arguments);
-	// int len = snprintf(outBuffer, 100, format, arguments);
-	// UartLog("len: %i, outBuffer: %s", len, outBuffer);
-	
-	// printf("%s", outBuffer);
+	int len = vsnprintf(dst, UPRINTF_MAX_SIZE, format, arguments);
 	
 	va_end(arguments);
-	
-	uint8_t res = CDC_Transmit_FS((uint8_t *)&outBuffer, len);
+
+	if (len < 0) {
+		len = 0;
+	} else if (len >= UPRINTF_MAX_SIZE) {
+		len = UPRINTF_MAX_SIZE - 1; /* truncated */
+	}
+	ucommit(len);
+
+	return len;
+}
+
+/* Zero-copy transmit: reserve room for the worst case, render in place, then ucommit() the
+   actual length. NULL when the TX queue is full (host not reading) or an interrupted
+   render holds it, the output is dropped. The render runs with the interrupts on */
+char *ureserve(uint16_t len)
+{
+	char *dst;
+
+	if (replyVendor) {
+		textFrame = VND_TxReserve_FS(len + TEXT_FRAME_EXTRA);
+		dst = (textFrame != NULL) ? (char *)textFrame + TEXT_FRAME_HEADROOM + 1 : NULL;
+	} else {
+		dst = (char *)CDC_TxReserve_FS(len);
+	}
+
+	if (dst == NULL) {
+		UartLog("USB_BUSY");
+	}
+	return dst;
+}
+
+void ucommit(uint16_t len)
+{
+	if (replyVendor) {
+		uint8_t *payload = textFrame + TEXT_FRAME_HEADROOM;
+
+		payload[0] = RECORD_TYPE_TEXT;
+		VND_TxCommit_FS((len > 0) ? binaryFrame(payload, len + 1, textFrame) : 0);
+	} else {
+		CDC_TxCommit_FS(len);
+	}
+}
+
+/* Unformatted transmit, for binary frames and already formatted strings */
+int uwrite(const uint8_t *buf, uint16_t len)
+{
+	uint8_t res = CDC_Transmit_FS((uint8_t *)buf, len);
 	if (res == USBD_BUSY)
 	{
+		/* the TX queue is full (host not reading), dropped */
 		UartLog("USB_BUSY");
 	}	
 
 	return len;
 }
 
-void processVCPinput(void)
+/* Main loop: runs the commands queued by the USB ISRs. Parsing, flash writes and replies
+   don't hold the USB interrupt, the OUT endpoints NAK while the queues are full */
+void processCommands(void)
 {
-	if (shellBuffer.newLine){
-		if (shellBuffer.idx == 2){
-			/* only 1 character, let's ignore longer strings (ModemManager or console echo issues) */
-			processChar(shellBuffer.Buf[0]);
-		} 
-		else if ((shellBuffer.idx > 2) && (shellBuffer.Buf[0] == '{')){
-			/* we have probably a JSON object */
-			processJson(shellBuffer.Buf);
+	uint8_t rxChar;
+	uint8_t end;
+	const uint8_t *packet;
+	uint16_t len;
+
+	/* a line or an object per call. A '{' starting a line goes to the JSON reader up to its '}' */
+	while (!shellBuffer.newLine) {
+		uint16_t count = CDC_RxRead_FS(&rxChar, 1, &end);
+		uint8_t events = 0;
+
+		if (count == 1) {
+			if (!jsonStreamIdle(&cdcJson.json) || (shellBuffer.idx == 0 && rxChar == '{')) {
+				events = shellJsonPut(&cdcJson, rxChar);
+			} else {
+				shellPutChar(&shellBuffer, rxChar);
+			}
 		}
+		if (end) {
+			/* a program writes a whole line at once, it ends with the transfer. An object
+			   goes on over any number of transfers, after a bad one the next starts clean */
+			if (jsonStreamIdle(&cdcJson.json)) {
+				shellPutChar(&shellBuffer, '\n');
+			} else {
+				jsonStreamResync(&cdcJson.json);
+			}
+		}
+		if (count == 0 || (events & (JSON_STREAM_END | JSON_STREAM_ERROR))) {
+			break;
+		}
+	}
+	processInput(&shellBuffer);
+
+	/* vendor interface: JSON objects and binary requests, both can span any number of packets
+	   and transfers. The packet is held (the endpoint NAKs) while a response waits for room */
+	protoFlush();
+	packet = VND_RxPacket_FS(&len);
+	if (packet != NULL) {
+		replyVendor = true;
+		while (vendorPos < len && vendorPut(packet[vendorPos])) {
+			vendorPos++;
+		}
+		replyVendor = false;
 
-		/* trailing end of lines confuse the jsmn parser, let's clean after always..*/
-		for (int i = 0; i < sizeof(shellBuffer.Buf); ++i)
-		{
-			shellBuffer.Buf[i] = 0;
+		if (vendorPos < len) {
+			return;
+		}
+		vendorPos = 0;
+		if (len < VND_DATA_FS_MAX_PACKET_SIZE) {
+			/* end of a transfer: after a bad object, the next one starts clean */
+			jsonStreamResync(&vendorJson.json);
 		}
+		VND_RxResume_FS();
+	}
+}
+
+/* A '{' out of a request frame starts a JSON object, the other bytes are frames (thProto.h) */
+static bool vendorPut(uint8_t byte)
+{
+	if (!jsonStreamIdle(&vendorJson.json) || (protoIdle() && byte == '{')) {
+		shellJsonPut(&vendorJson, byte);
+		return true;
+	}
+	return protoPut(byte);
+}
+
+/* Line editing for terminals, a program's string gets its '\n' from the transfer end (processCommands()) */
+static void shellPutChar(shellBuffer_t *input, uint8_t rxChar)
+{
+	if (rxChar == '\n' || rxChar == '\r') {
+		/* Some consoles send \r on ENTER, so let's take it as a line feed too */
+		if (input->overflow) {
+			input->overflow = false;
+			input->idx = 0;
+		} else if (input->idx > 0) {
+			input->Buf[input->idx++] = '\n';
+			input->newLine = true;
+		}
+	} else if (rxChar == 127 || rxChar == 8) { /* DEL or BackSpace */
+		if (input->idx > 0) {
+			input->idx--;
+		}
+	} else if (input->idx < SHELL_BUFFER_LENGTH - 2) {
+		/* We just assume it's a printable character... */
+		input->Buf[input->idx++] = rxChar;
+	} else {
+		/* too long to process, wait for the end of the line */
+		input->overflow = true;
+	}
+}
+
+static void processInput(shellBuffer_t *input)
+{
+	if (input->newLine){
+		if (input->idx == 2){
+			/* only 1 character, let's ignore longer strings (ModemManager or console echo issues) */
+			processChar(input->Buf[0]);
+		} 
+
 		/* get ready for a new message */
-		shellBuffer.idx = 0;
-		shellBuffer.newLine = false;
+		input->idx = 0;
+		input->newLine = false;
 	} 
 }
 
 static void showConfig()
 {
 	uint32_t timestamp = HAL_GetTick();
+	char offsetStr[16];
+
+	/* no float printf support linked, see thOutput.c */
+	*fmtFixed(offsetStr, toFixed(thConfig.temperatureOffset, 2), 2, 2, 0) = '\0';
 	uprintf("\n\r-------------------------------------------------------- \
 			\n\r***  Device: *\"%s\"* -- Status: \
-			\n\r Reporing period: %s, Format: %s, Temp.Offset: %2.2f C, Uptime: %lu ms, Serial #: %s, FW: v%d.%d.%d\
+			\n\r Reporing period: %s, Format: %s, Temp.Offset: %s C, Uptime: %lu ms, Serial #: %s, FW: v%d.%d.%d\
 			\n\r-------------------------------------------------------- \n\r", 
 			HW_ID,
 			PERIOD_STRING[thConfig.reportingPeriodIdx], 
 			FORMAT_STRING[thConfig.format], 
-			thConfig.temperatureOffset,
+			offsetStr,
 			timestamp,
 			thConfig.serialNumberStr,
 			VERSION_MAJOR,
@@ -177,6 +422,24 @@ void processChar(uint8_t input)
 			uprintf("\n\r*** Config: Set output format to CSV. \
 					\n\rFormat: [temperature], [pressure], [humitidy], [gasResistance], [IAQ], [accuracy], [eqCO2], [eqBreathVOC]\n\r");
 			break;	
+		case 'B':
+			thConfig.format = BINARY;
+			uprintf("\n\r*** Config: Set output format to Binary (COBS framed, 0x00 delimited).\n\r");
+			break;	
+		case 'O': {
+			/* the short keys CBOR sends, from fieldTable (3 characters at most) */
+			char keys[FIELD_COUNT * 5];
+			char *p = keys;
+
+			for (uint8_t n = 0; n < FIELD_COUNT; n++) {
+				p = fmtStr(p, (n > 0) ? ", " : "");
+				p = fmtStr(p, fieldTable[n].key);
+			}
+			*p = '\0';
+			thConfig.format = CBOR;
+			uprintf("\n\r*** Config: Set output format to CBOR (one map per sample, keys: %s).\n\r", keys);
+			break;
+		}
 		case 'D':
 			thConfig.ledEnabled = false;
 			uprintf("\n\rConfig: Disable LED\n\r");
@@ -227,100 +490,351 @@ void processChar(uint8_t input)
 		default:
 			uprintf("\n\r------------------------------------------------------- \
 					\n\r***  Invalid option. \
-					\n\r Use:              [m] Human readable, [j] JSON, [c] CSV, [s] Status, [e/d] enable/disable LED\
+					\n\r Use:              [m] Human readable, [j] JSON, [c] CSV, [b] Binary, [o] CBOR, [s] Status, [e/d] enable/disable LED\
 					\n\r Reporting Period: [1] 3 sec, [2] 10 sec, [3] 30 sec, [4] 1 min, [5] 10 min, [6] 30 min, [7] 1 hour. \
 					\n\r-------------------------------------------------------- \n\r");
 	}
 }		
 
-static int processJson(const char *buffer)
+/* Entry of the key in commandTable (thCommands.h), NULL if unknown. Seeded FNV-1a, as tools/cmdhash.py */
+static const command_t *commandFind(const char *key, uint8_t len)
 {
-	jsmn_parser p;
-	jsmntok_t tokens[20]; /* We expect no more than 20 tokens */
-	char keyFirstChar = 0;
-	bool saveConf = false;
+	uint32_t h = COMMAND_HASH_SEED;
 
-	jsmn_init(&p);
-	int ret = jsmn_parse(&p, buffer, strlen(buffer), tokens,
-	             sizeof(tokens) / sizeof(tokens[0]));
-	
-	if (ret < 0) {
-		printf("Failed to parse JSON: %d\n\r", ret);
-		return 1;
-	}
-
-	/* Assume the top-level element is an object */
-	if (ret < 1 || tokens[0].type != JSMN_OBJECT) {
-		printf("Object expected\n\r");
-		return 1;
-	}
-
- 	/* Loop over all keys of the root object */
-	for (int i = 1; i < ret; i++) {
-	    if (jsoneq(buffer, &tokens[i], "status") == 0) {
-	      /* reply with the status and finish */
-	    	jsonPrintStatus();
-	    	return ret;
-	    } 
-	    else if (jsoneq(buffer, &tokens[i], "info") == 0) {
-	    	jsonPrintDevInfo();
-	    	return ret;
-	    }
-	    else if (jsoneq(buffer, &tokens[i], "led") == 0) {
-			keyFirstChar = buffer[tokens[i + 1].start];
-			
-			if (keyFirstChar == 't'){
-				/*true*/
-				thConfig.ledEnabled = true;
-			} else if (keyFirstChar == 'f'){
-			/*false*/
-				thConfig.ledEnabled = false;
+	for (uint8_t n = 0; n < len; n++) {
+		h = (h ^ (uint8_t)key[n]) * 16777619UL;
+	}
+	const command_t *cmd = &commandTable[h >> COMMAND_HASH_SHIFT];
+
+	if (cmd->key == NULL || cmd->len != len || memcmp(cmd->key, key, len) != 0) {
+		return NULL;
+	}
+	return cmd;
+}
+
+/* Converts the token to the command's type, false if it isn't one */
+static bool commandValue(const command_t *cmd, cmdValue_t *value)
+{
+	const char *start;
+	const char *end;
+	char *last;
+	uint16_t len;
+
+	if (value->tok == NULL) {
+		/* a key alone */
+		return (cmd->type == VALUE_NONE);
+	}
+	start = value->json + value->tok->start;
+	end = value->json + value->tok->end;
+	len = end - start;
+
+	switch (cmd->type) {
+		case VALUE_BOOL:
+			if (len == 4 && memcmp(start, "true", 4) == 0) {
+				value->b = true;
+			} else if (len == 5 && memcmp(start, "false", 5) == 0) {
+				value->b = false;
+			} else {
+				return false;
+			}
+			return true;
+		case VALUE_UINT:
+			if (!isdigit((uint8_t)*start)) {
+				return false;
 			}
-			i++;
-	    } 
-	    else if (jsoneq(buffer, &tokens[i], "format") == 0) {
-	    	keyFirstChar = buffer[tokens[i + 1].start];
-
-	    	if (toUpperCase(keyFirstChar) == 'C'){
-	    		thConfig.format = CSV;
-	    	} else if (toUpperCase(keyFirstChar) == 'J'){
-	    		thConfig.format = JSON;
-	    	} else if (toUpperCase(keyFirstChar) == 'H'){
-	    		thConfig.format = HUMAN;
-	    	}
-	    	i++;
-	    }
-	    else if (jsoneq(buffer, &tokens[i], "reportingPeriod") == 0) {
-	    	const char* start = buffer + tokens[i + 1].start;
-	    	uint32_t value = strtoul(start, NULL, 10);
-
-	    	if (value >= 1 && value <= 3600) 
-	    		thConfig.reportingPeriod = value; 
-	    	i++;
-	    }
-	    else if (jsoneq(buffer, &tokens[i], "temperatureOffset") == 0) {
-	    	const char* start = buffer + tokens[i + 1].start;
-	    	float value = strtof(start, NULL); 
-
-	    	if (value >= -15.0f && value <= 15.0f){ 
-	    		thConfig.temperatureOffset = value; 
-	    	}
-	    	i++;
-	    }
-	    else if (jsoneq(buffer, &tokens[i], "saveConfig") == 0) {
-	    	/* store thConfig in Flash after processing all keys...*/
-	    	saveConf = true;
-	    	i++;
-	    }
-	}
-
-	if (saveConf) {
+			/* out of range is rejected, not saturated */
+			errno = 0;
+			value->u = strtoul(start, &last, 10);
+			return (last == end && errno == 0);
+		case VALUE_FLOAT:
+			value->f = strtof(start, &last);
+			return (last == end && last != start);
+		default:
+			return true;
+	}
+}
+
+/* Stages a member of the object, {"key": value}, if the key is a command and the value its type */
+static void processMember(shellJson_t *sh)
+{
+	const jsonMember_t *m = sh->json.member;
+	const jsmntok_t *key = &m->tokens[0];
+	const command_t *cmd = commandFind(m->buf + key->start, key->end - key->start);
+	cmdValue_t value = { .json = m->buf, .tok = (m->count > 1) ? &m->tokens[1] : NULL };
+	uint8_t *staged = (uint8_t *)&jsonConfig;
+	const uint8_t *config = (const uint8_t *)&thConfig;
+
+	if (cmd == NULL || !commandValue(cmd, &value)) {
+		/* unknown or the wrong type, leave the setting as it is */
+		return;
+	}
+	if (jsonObject.owner != sh) {
+		if (sh->staged) {
+			/* taken by another source meanwhile */
+			return;
+		}
+		jsonObject.owner = sh;
+		jsonObject.changed = 0;
+		jsonObject.save = false;
+		jsonObject.actions = 0;
+		sh->staged = true;
+	}
+	if (cmd->action) {
+		if (jsonObject.actions < JSON_ACTIONS_MAX) {
+			jsonObject.action[jsonObject.actions].cmd = cmd;
+			jsonObject.action[jsonObject.actions].u = value.u;
+			jsonObject.actions++;
+		}
+		return;
+	}
+
+	/* the fields the object didn't write follow thConfig, the ones the handler changes are its own */
+	for (uint8_t i = 0; i < sizeof(configFields) / sizeof(configFields[0]); i++) {
+		if (!(jsonObject.changed & (1 << i))) {
+			memcpy(staged + configFields[i].offset, config + configFields[i].offset, configFields[i].size);
+		}
+	}
+	if (cmd->handler(&value) == CMD_SAVE) {
+		jsonObject.save = true;
+	}
+	for (uint8_t i = 0; i < sizeof(configFields) / sizeof(configFields[0]); i++) {
+		if (memcmp(staged + configFields[i].offset, config + configFields[i].offset, configFields[i].size) != 0) {
+			jsonObject.changed |= 1 << i;
+		}
+	}
+}
+
+/* The object is closed: its settings into thConfig, then its actions */
+static void processObject(void)
+{
+	const uint8_t *staged = (const uint8_t *)&jsonConfig;
+	uint8_t *config = (uint8_t *)&thConfig;
+	bool replied = false;
+
+	/* the interrupts read thConfig, they see the object's settings all at once */
+	__disable_irq();
+	for (uint8_t i = 0; i < sizeof(configFields) / sizeof(configFields[0]); i++) {
+		if (jsonObject.changed & (1 << i)) {
+			memcpy(config + configFields[i].offset, staged + configFields[i].offset, configFields[i].size);
+		}
+	}
+	__enable_irq();
+
+	for (uint8_t n = 0; n < jsonObject.actions && !replied; n++) {
+		cmdValue_t value = { .u = jsonObject.action[n].u };
+
+		replied = (jsonObject.action[n].cmd->handler(&value) == CMD_DONE);
+	}
+	/* store thConfig in Flash after processing all keys...*/
+	if (jsonObject.save) {
 		saveConfig(&thConfig);
-		saveConf = false;
 	}
+	if (!replied) {
+		jsonPrintStatus();
+	}
+}
+
+/* Feeds a byte to the source's JSON reader and runs the object once it's complete. Returns its events */
+static uint8_t shellJsonPut(shellJson_t *sh, char c)
+{
+	uint8_t events = jsonStreamPut(&sh->json, c);
+
+	if (events & JSON_STREAM_MEMBER) {
+		processMember(sh);
+	}
+	if ((events & JSON_STREAM_ERROR) || ((events & JSON_STREAM_END) && sh->staged && jsonObject.owner != sh)) {
+		/* nothing of it is applied */
+		printf("Failed to parse JSON\n\r");
+	}
+	else if (events & JSON_STREAM_END) {
+		if (sh->staged) {
+			processObject();
+		} else {
+			/* {} or only unknown keys */
+			jsonPrintStatus();
+		}
+	}
+	if (events & (JSON_STREAM_END | JSON_STREAM_ERROR)) {
+		if (jsonObject.owner == sh) {
+			jsonObject.owner = NULL;
+		}
+		sh->staged = false;
+	}
+	return events;
+}
 
+static cmdResult_t cmdStatus(const cmdValue_t *value)
+{
+	/* reply with the status and finish */
 	jsonPrintStatus();
-	return ret;
+	return CMD_DONE;
+}
+
+static cmdResult_t cmdInfo(const cmdValue_t *value)
+{
+	jsonPrintDevInfo();
+	return CMD_DONE;
+}
+
+static cmdResult_t cmdReplay(const cmdValue_t *value)
+{
+	/* stream the samples newer than the given seq, from the main loop, to the interface asking */
+	uint32_t since = value->u;
+	uint32_t first = historyFirstSeq();
+
+	if (historyReplay(since, replyVendor)) {
+		uprintf("{\"replay\":{\"from\":%lu,\"to\":%lu}}\r\n", (since < first) ? first : since + 1, historyLastSeq());
+	} else {
+		uprintf("{\"replay\":{\"from\":0,\"to\":0}}\r\n");
+	}
+	return CMD_DONE;
+}
+
+static cmdResult_t cmdLogDump(const cmdValue_t *value)
+{
+	/* same as replay, from the flash log. seq is the log record index */
+	uint32_t since = value->u;
+	uint32_t first = flashLogFirst();
+
+	if (historyReplayLog(since, replyVendor)) {
+		uprintf("{\"logDump\":{\"from\":%lu,\"to\":%lu}}\r\n", (since < first) ? first : since + 1, flashLogLast());
+	} else {
+		uprintf("{\"logDump\":{\"from\":0,\"to\":0}}\r\n");
+	}
+	return CMD_DONE;
+}
+
+static cmdResult_t cmdLed(const cmdValue_t *value)
+{
+	jsonConfig.ledEnabled = value->b;
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdFormat(const cmdValue_t *value)
+{
+	char keyFirstChar = value->json[value->tok->start];
+
+	if (jsoneqNoCase(value->json, value->tok, "CBOR") == 0){
+		/* full name, "C" alone still means CSV */
+		jsonConfig.format = CBOR;
+	} else if (toUpperCase(keyFirstChar) == 'C'){
+		jsonConfig.format = CSV;
+	} else if (toUpperCase(keyFirstChar) == 'J'){
+		jsonConfig.format = JSON;
+	} else if (toUpperCase(keyFirstChar) == 'H'){
+		jsonConfig.format = HUMAN;
+	} else if (toUpperCase(keyFirstChar) == 'B'){
+		jsonConfig.format = BINARY;
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdFields(const cmdValue_t *value)
+{
+	/* ["IAQ", "eqCO2"] (JSON or CBOR key names) or the bit mask as a number */
+	uint16_t mask = jsonFieldMask(value->json, value->tok);
+
+	if (mask != 0) {
+		/* the BSEC subscription follows on the next sample (thBsec.c) */
+		jsonConfig.fieldMask = mask;
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdReportingPeriod(const cmdValue_t *value)
+{
+	if (value->u >= 1 && value->u <= 3600) {
+		jsonConfig.reportingPeriod = value->u;
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdTemperatureOffset(const cmdValue_t *value)
+{
+	if (value->f >= -15.0f && value->f <= 15.0f){
+		jsonConfig.temperatureOffset = value->f;
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdReport(const cmdValue_t *value)
+{
+	/* "last" sample or window "stats" every reporting period */
+	for (uint8_t mode = 0; mode < REPORT_MODES; mode++) {
+		if (jsoneqNoCase(value->json, value->tok, REPORT_STRING[mode]) == 0) {
+			jsonConfig.reportMode = mode;
+		}
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdDeadband(const cmdValue_t *value)
+{
+	/* {"IAQ": 5, "eqCO2": 50}, the fields not listed keep their threshold */
+	jsonDeadband(value->json, value->tok);
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdStatsLast(const cmdValue_t *value)
+{
+	jsonConfig.statsLast = value->b;
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdLogPeriod(const cmdValue_t *value)
+{
+	/* 0 stops logging, short periods would wear the flash out */
+	if (value->u == 0 || (value->u >= LOG_PERIOD_MIN && value->u <= UINT16_MAX)) {
+		jsonConfig.logPeriod = value->u;
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdCatchUp(const cmdValue_t *value)
+{
+	jsonConfig.catchUp = value->b;
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdHidInterval(const cmdValue_t *value)
+{
+	/* ms, 0 stops the HID input reports */
+	if (value->u == 0 || (value->u >= HID_INTERVAL_MIN && value->u <= HID_INTERVAL_MAX)) {
+		jsonConfig.hidInterval = value->u;
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdHidSize(const cmdValue_t *value)
+{
+	/* the report descriptor changes: saveConfig, then it's used from the next boot */
+	if (value->u == 2 || value->u == 4) {
+		jsonConfig.hidValueSize = value->u;
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdSampleRate(const cmdValue_t *value)
+{
+	/* "LP" or "ULP", the BSEC loop switches before its next sample */
+	for (uint8_t rate = 0; rate < SAMPLE_RATE_MODES; rate++) {
+		if (jsoneqNoCase(value->json, value->tok, SAMPLE_RATE_STRING[rate]) == 0) {
+			jsonConfig.sampleRate = rate;
+		}
+	}
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdMeasure(const cmdValue_t *value)
+{
+	/* ULP: one more sample as soon as BSEC allows it */
+	bsec_iot_measure();
+	return CMD_NEXT;
+}
+
+static cmdResult_t cmdSaveConfig(const cmdValue_t *value)
+{
+	return CMD_SAVE;
 }
 
 static char toUpperCase(const char ch)
@@ -334,10 +848,37 @@ static char toUpperCase(const char ch)
 static void jsonPrintStatus(void)
 {
 	uint32_t timestamp = HAL_GetTick();
-	uprintf("{\"status\":{\"reportingPeriod\":%lu,\"format\":\"%s\",\"temperatureOffset\":%2.1f,\"upTime\":%lu}}\r\n",  
+	char offsetStr[16];
+	char deadbandStr[192];
+	char *p = deadbandStr;
+
+	*fmtFixed(offsetStr, toFixed(thConfig.temperatureOffset, 1), 1, 2, 0) = '\0';
+
+	/* the thresholds in use only */
+	for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+		if (thConfig.deadband[i] > 0.0f) {
+			p = fmtStr(p, (p == deadbandStr) ? "{\"" : ",\"");
+			p = fmtStr(p, fieldTable[i].name);
+			p = fmtStr(p, "\":");
+			p = fmtFixed(p, toFixed(thConfig.deadband[i], fieldTable[i].jsonDecimals), fieldTable[i].jsonDecimals, 0, 0);
+		}
+	}
+	p = fmtStr(p, (p == deadbandStr) ? "{}" : "}");
+	*p = '\0';
+	uprintf("{\"status\":{\"reportingPeriod\":%lu,\"format\":\"%s\",\"report\":\"%s\",\"deadband\":%s,\"temperatureOffset\":%s,\"fields\":%u,\"seq\":%lu,\"logPeriod\":%u,\"log\":%lu,\"hidInterval\":%lu,\"hidSize\":%u,\"catchUp\":%s,\"sampleRate\":\"%s\",\"upTime\":%lu}}\r\n",  
 				thConfig.reportingPeriod,
 				FORMAT_STRING[thConfig.format],
-				thConfig.temperatureOffset,
+				REPORT_STRING[thConfig.reportMode],
+				deadbandStr,
+				offsetStr,
+				thConfig.fieldMask,
+				historyLastSeq(),
+				thConfig.logPeriod,
+				flashLogLast(),
+				thConfig.hidInterval,
+				thConfig.hidValueSize,
+				thConfig.catchUp ? "true" : "false",
+				SAMPLE_RATE_STRING[thConfig.sampleRate],
 				timestamp);
 }
 
@@ -351,13 +892,88 @@ static void jsonPrintDevInfo(void)
 				VERSION_PATCH);
 }
 
-static int jsoneq(const char *json, jsmntok_t *tok, const char *s) 
+/* Returns 0 if the token isn't a valid field list */
+static uint16_t jsonFieldMask(const char *json, const jsmntok_t *tok)
 {
-  if (tok->type == JSMN_STRING && (int)strlen(s) == tok->end - tok->start &&
-      strncmp(json + tok->start, s, tok->end - tok->start) == 0) {
+  uint16_t mask = 0;
+
+  if (tok->type == JSMN_PRIMITIVE) {
+    return strtoul(json + tok->start, NULL, 0) & FIELD_MASK_ALL;
+  }
+  if (tok->type != JSMN_ARRAY) {
     return 0;
   }
-  return -1;
+  const jsmntok_t *item = tok + 1;
+
+  for (int n = 0; n < tok->size; n++, item += jsonSkip(item)) {
+    uint8_t field = jsonField(json, item);
+
+    if (field == FIELD_COUNT) {
+      return 0; /* unknown name, leave the mask as it is */
+    }
+    mask |= 1 << field;
+  }
+  return mask;
+}
+
+/* Tokens taken by a value, its children included: the step to the next one */
+static int jsonSkip(const jsmntok_t *tok)
+{
+  int count = 1;
+
+  for (int n = 0; n < tok->size; n++) {
+    count += jsonSkip(tok + count);
+  }
+  return count;
+}
+
+/* Field from its JSON or CBOR key name, FIELD_COUNT if unknown */
+static uint8_t jsonField(const char *json, const jsmntok_t *tok)
+{
+  uint8_t field;
+
+  for (field = 0; field < FIELD_COUNT; field++) {
+    if (jsoneqNoCase(json, tok, fieldTable[field].name) == 0 ||
+        jsoneqNoCase(json, tok, fieldTable[field].key) == 0) {
+      break;
+    }
+  }
+  return field;
+}
+
+/* Deadband object, {"name": threshold, ...} */
+static void jsonDeadband(const char *json, const jsmntok_t *tok)
+{
+  if (tok->type != JSMN_OBJECT) {
+    return;
+  }
+  const jsmntok_t *key = tok + 1;
+
+  for (int n = 0; n < tok->size; n++, key += jsonSkip(key)) {
+    uint8_t field = jsonField(json, key);
+    float value;
+
+    if (key[1].type != JSMN_PRIMITIVE) {
+      continue;
+    }
+    value = strtof(json + key[1].start, NULL);
+    if (field < FIELD_COUNT && value >= 0.0f && value <= 100000.0f) {
+      jsonConfig.deadband[field] = value;
+    }
+  }
+}
+
+static int jsoneqNoCase(const char *json, const jsmntok_t *tok, const char *s) 
+{
+  if (tok->type != JSMN_STRING || (int)strlen(s) != tok->end - tok->start) {
+    return -1;
+  }
+  for (int i = 0; i < tok->end - tok->start; i++) {
+    if (toUpperCase(json[tok->start + i]) != toUpperCase(s[i])) {
+      return -1;
+    }
+  }
+  return 0;
 }
 
 /* Robert Jenkins' 32 bit integer hash function */
@@ -0,0 +1,205 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include "thDisk.h"
+#include "thOutput.h"
+#include "flashLog.h"
+
+#define DISK_MEDIA			0xF8
+#define DISK_DATE			((40 << 9) | (1 << 5) | 1)	/* 2020-01-01, FAT date format */
+#define DIR_ATTR_READ_ONLY	0x01
+#define DIR_ATTR_VOLUME_ID	0x08
+#define DIR_ATTR_ARCHIVE	0x20
+
+/* Records in the file, taken when the host mounts the volume: hosts cache the directory,
+   the file size has to stay put until the next mount */
+static uint32_t logFirst = 0;
+static uint32_t logCount = 0;
+
+/* BIOS parameter block, the rest of the boot sector is zero but for the signature */
+static const uint8_t bootSector[] = {
+	0xEB, 0x3C, 0x90,								/* jump */
+	'M', 'S', 'D', 'O', 'S', '5', '.', '0',			/* OEM name */
+	DISK_BLOCK_SIZE & 0xFF, DISK_BLOCK_SIZE >> 8,	/* bytes per sector */
+	1,												/* sectors per cluster */
+	DISK_FAT_START, 0,								/* reserved sectors */
+	2,												/* FATs */
+	DISK_ROOT_ENTRIES, 0,							/* root directory entries */
+	DISK_BLOCKS & 0xFF, DISK_BLOCKS >> 8,			/* sectors */
+	DISK_MEDIA,
+	DISK_FAT_SECTORS, 0,							/* sectors per FAT */
+	1, 0,											/* sectors per track */
+	1, 0,											/* heads */
+	0, 0, 0, 0,										/* hidden sectors */
+	0, 0, 0, 0,										/* sectors, 32 bits */
+	0x80,											/* drive number */
+	0,
+	0x29,											/* extended boot signature */
+	0x01, 0x00, 0x4F, 0xAC,							/* volume serial number */
+	'U', 'T', 'H', 'I', 'N', 'G', 'V', 'O', 'C', ' ', ' ',
+	'F', 'A', 'T', '1', '2', ' ', ' ', ' ',
+};
+
+_Static_assert(CSV_LINE_SIZE * CSV_LINES_PER_BLOCK == DISK_BLOCK_SIZE, "CSV lines have to tile the sectors");
+_Static_assert(DISK_BLOCKS <= 0xFFFF, "16-bit sector count in the boot sector");
+
+/* The newest records that fit, the header line takes one */
+void diskSnapshot(void)
+{
+	uint32_t last = flashLogLast();
+	uint32_t maxCount = DISK_CLUSTERS * CSV_LINES_PER_BLOCK - 1;
+
+	if (last == 0) {
+		logFirst = 0;
+		logCount = 0;
+		return;
+	}
+	logFirst = flashLogFirst();
+	logCount = last - logFirst + 1;
+	if (logCount > maxCount) {
+		logFirst = last - maxCount + 1;
+		logCount = maxCount;
+	}
+}
+
+static uint32_t fileSize(void)
+{
+	return (1 + logCount) * CSV_LINE_SIZE;
+}
+
+static uint32_t fileClusters(void)
+{
+	return (fileSize() + DISK_BLOCK_SIZE - 1) / DISK_BLOCK_SIZE;
+}
+
+static void put16(uint8_t *dst, uint16_t value)
+{
+	dst[0] = value & 0xFF;
+	dst[1] = value >> 8;
+}
+
+/* FAT12 entry n, the file is one chain from cluster 2 */
+static uint16_t fatEntry(uint32_t n)
+{
+	uint32_t clusters = fileClusters();
+
+	if (n < 2) {
+		return (n == 0) ? (0xF00 | DISK_MEDIA) : 0xFFF;
+	}
+	if (n - 2 >= clusters) {
+		return 0;
+	}
+	return (n - 2 == clusters - 1) ? 0xFFF : n + 1;
+}
+
+/* Two 12-bit entries per 3 bytes */
+static void fatRead(uint32_t sector, uint8_t *dst)
+{
+	for (uint32_t b = sector * DISK_BLOCK_SIZE, i = 0; i < DISK_BLOCK_SIZE; b++, i++) {
+		uint16_t even = fatEntry(b / 3 * 2);
+		uint16_t odd = fatEntry(b / 3 * 2 + 1);
+
+		switch (b % 3) {
+		case 0:
+			dst[i] = even & 0xFF;
+			break;
+		case 1:
+			dst[i] = (even >> 8) | ((odd & 0x0F) << 4);
+			break;
+		default:
+			dst[i] = odd >> 4;
+			break;
+		}
+	}
+}
+
+static void dirEntry(uint8_t *dst, const char *name, uint8_t attr, uint16_t cluster, uint32_t size)
+{
+	memcpy(dst, name, 11);
+	dst[11] = attr;
+	put16(&dst[16], DISK_DATE);		/* created */
+	put16(&dst[18], DISK_DATE);		/* accessed */
+	put16(&dst[24], DISK_DATE);		/* written */
+	put16(&dst[26], cluster);
+	put16(&dst[28], size & 0xFFFF);
+	put16(&dst[30], size >> 16);
+}
+
+/* The header names the JSON keys. A record cut by a reset keeps its line, with the index only */
+static void csvLine(uint32_t line, char *dst)
+{
+	static char text[SERIALIZED_SAMPLE_MAX_SIZE];
+	char *p = text;
+	sample_t sample;
+	uint16_t len;
+
+	if (line == 0) {
+		p = fmtStr(p, "seq, timestamp");
+		for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+			p = fmtStr(p, ", ");
+			p = fmtStr(p, fieldTable[i].name);
+		}
+		*p++ = ',';
+	} else if (flashLogGet(logFirst + line - 1, &sample)) {
+		sample.fieldMask = FIELD_MASK_ALL;
+		p += serializeSample(&sample, CSV, true, text) - 2;		/* without the "\r\n" */
+	} else {
+		p = fmtUint(p, logFirst + line - 1);
+		*p++ = ',';
+	}
+
+	len = p - text;
+	if (len > CSV_LINE_SIZE - 2) {
+		len = CSV_LINE_SIZE - 2;
+	}
+	memcpy(dst, text, len);
+	memset(dst + len, ' ', CSV_LINE_SIZE - 2 - len);
+	dst[CSV_LINE_SIZE - 2] = '\r';
+	dst[CSV_LINE_SIZE - 1] = '\n';
+}
+
+/* Main loop only, the records come from flash */
+void diskRead(uint32_t block, uint8_t *dst)
+{
+	memset(dst, 0, DISK_BLOCK_SIZE);
+
+	if (block == 0) {
+		memcpy(dst, bootSector, sizeof(bootSector));
+		dst[510] = 0x55;
+		dst[511] = 0xAA;
+	} else if (block < DISK_ROOT_START) {
+		fatRead((block - DISK_FAT_START) % DISK_FAT_SECTORS, dst);
+	} else if (block == DISK_ROOT_START) {
+		dirEntry(dst, "UTHINGVOC  ", DIR_ATTR_VOLUME_ID, 0, 0);
+		dirEntry(dst + 32, "LOG     CSV", DIR_ATTR_READ_ONLY | DIR_ATTR_ARCHIVE, 2, fileSize());
+	} else if (block >= DISK_DATA_START && block < DISK_BLOCKS) {
+		uint32_t line = (block - DISK_DATA_START) * CSV_LINES_PER_BLOCK;
+		uint32_t lines = 1 + logCount;
+
+		for (uint8_t i = 0; i < CSV_LINES_PER_BLOCK && line < lines; i++, line++) {
+			csvLine(line, (char *)dst + i * CSV_LINE_SIZE);
+		}
+	}
+}
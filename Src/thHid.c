@@ -0,0 +1,263 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include "main.h"
+#include "usbd_cdc_if.h"
+#include "thConfig.h"
+#include "thOutput.h"
+#include "thHid.h"
+
+extern configs_t thConfig;
+
+/* HID Usage Tables, Sensors page */
+#define HID_USAGE_PAGE_SENSOR			0x20
+#define HID_USAGE_ENV_PRESSURE			0x31	/* Environmental: Atmospheric Pressure */
+#define HID_USAGE_ENV_HUMIDITY			0x32	/* Environmental: Humidity */
+#define HID_USAGE_ENV_TEMPERATURE		0x33	/* Environmental: Temperature */
+#define HID_USAGE_OTHER_CUSTOM			0xE1	/* Other: Custom */
+#define HID_USAGE_PROP_REPORT_INTERVAL	0x030E
+#define HID_USAGE_DATA_PRESSURE			0x0431	/* bar */
+#define HID_USAGE_DATA_HUMIDITY			0x0433	/* % */
+#define HID_USAGE_DATA_TEMPERATURE		0x0434	/* Celsius */
+#define HID_USAGE_DATA_CUSTOM_VALUE_1	0x0544
+#define HID_USAGE_DATA_CUSTOM_VALUE_2	0x0545
+
+/* Short items, size bits cleared */
+#define HID_ITEM_USAGE_PAGE		0x04
+#define HID_ITEM_USAGE			0x08
+#define HID_ITEM_COLLECTION		0xA0
+#define HID_ITEM_END_COLLECTION	0xC0
+#define HID_ITEM_REPORT_ID		0x84
+#define HID_ITEM_LOGICAL_MIN	0x14
+#define HID_ITEM_LOGICAL_MAX	0x24
+#define HID_ITEM_REPORT_SIZE	0x74
+#define HID_ITEM_REPORT_COUNT	0x94
+#define HID_ITEM_UNIT_EXPONENT	0x54
+#define HID_ITEM_INPUT			0x80
+#define HID_ITEM_FEATURE		0xB0
+
+#define HID_COLLECTION_APPLICATION	0x01
+#define HID_DATA_VAR_ABS			0x02
+
+_Static_assert(HID_REPORT_DESC_SIZE == HID_REPORT_DESC_SIZ, "HID report descriptor size mismatch");
+
+/* One application collection, its values in report order */
+typedef struct _hidSensor_t {
+	uint8_t		usage;
+	uint8_t		count;
+	uint16_t	dataUsage[2];
+	field_t		field[2];
+} hidSensor_t;
+
+static const hidSensor_t hidSensor[HID_SENSORS] = {
+	{ HID_USAGE_ENV_TEMPERATURE, 1, { HID_USAGE_DATA_TEMPERATURE }, { FIELD_TEMPERATURE } },
+	{ HID_USAGE_ENV_HUMIDITY,    1, { HID_USAGE_DATA_HUMIDITY },    { FIELD_HUMIDITY } },
+	{ HID_USAGE_ENV_PRESSURE,    1, { HID_USAGE_DATA_PRESSURE },    { FIELD_PRESSURE } },
+	/* no standard usages for these: IAQ index, then eqCO2 (ppm) */
+	{ HID_USAGE_OTHER_CUSTOM,    2, { HID_USAGE_DATA_CUSTOM_VALUE_1, HID_USAGE_DATA_CUSTOM_VALUE_2 }, { FIELD_IAQ, FIELD_CO2 } },
+};
+
+/* report value = value * scale * 10^decimals, the unit exponent is -decimals.
+   16 bit values trade resolution for range */
+typedef struct _hidScale_t {
+	float		scale;			/* to the HID unit */
+	uint8_t		decimals[2];	/* 16 bit, 32 bit values */
+} hidScale_t;
+
+static const hidScale_t hidScale[FIELD_COUNT] = {
+	[FIELD_TEMPERATURE]	= { 1.0f,  { 2, 3 } },
+	[FIELD_PRESSURE]	= { 1e-5f, { 4, 7 } },	/* Pa -> bar */
+	[FIELD_HUMIDITY]	= { 1.0f,  { 2, 3 } },
+	[FIELD_IAQ]			= { 1.0f,  { 1, 2 } },
+	[FIELD_CO2]			= { 1.0f,  { 0, 1 } },
+};
+
+static uint8_t reportDesc[HID_REPORT_DESC_SIZE];
+static uint8_t valueSize;		/* bytes per value, fixed at boot: the host has parsed the descriptor */
+static uint8_t report[HID_INPUT_REPORT_MAX];
+static uint8_t nextId;			/* next input report of the burst, 0: none */
+static uint32_t elapsed;		/* ms since the last burst */
+
+/* Appends a short item, size 0, 1, 2 or 4 bytes of little endian data */
+static uint8_t *hidItem(uint8_t *p, uint8_t item, uint32_t data, uint8_t size)
+{
+	*p++ = item | ((size == 4) ? 3 : size);
+	while (size--) {
+		*p++ = data & 0xFF;
+		data >>= 8;
+	}
+	return p;
+}
+
+/* Builds the report descriptor for thConfig.hidValueSize. Every item has a fixed length, so
+   the descriptor size is the same for both value sizes */
+void hidInit(void)
+{
+	uint8_t *p = reportDesc;
+	uint8_t wide = (thConfig.hidValueSize == 4);
+
+	valueSize = wide ? 4 : 2;
+	for (uint8_t s = 0; s < HID_SENSORS; s++) {
+		const hidSensor_t *sensor = &hidSensor[s];
+
+		p = hidItem(p, HID_ITEM_USAGE_PAGE, HID_USAGE_PAGE_SENSOR, 1);
+		p = hidItem(p, HID_ITEM_USAGE, sensor->usage, 1);
+		p = hidItem(p, HID_ITEM_COLLECTION, HID_COLLECTION_APPLICATION, 1);
+		p = hidItem(p, HID_ITEM_REPORT_ID, s + 1, 1);
+
+		p = hidItem(p, HID_ITEM_USAGE, HID_USAGE_PROP_REPORT_INTERVAL, 2);
+		p = hidItem(p, HID_ITEM_LOGICAL_MIN, 0, 4);
+		p = hidItem(p, HID_ITEM_LOGICAL_MAX, INT32_MAX, 4);
+		p = hidItem(p, HID_ITEM_REPORT_SIZE, 32, 1);
+		p = hidItem(p, HID_ITEM_REPORT_COUNT, 1, 1);
+		p = hidItem(p, HID_ITEM_UNIT_EXPONENT, 0, 1);
+		p = hidItem(p, HID_ITEM_FEATURE, HID_DATA_VAR_ABS, 1);
+
+		for (uint8_t v = 0; v < sensor->count; v++) {
+			int8_t exponent = -(int8_t)hidScale[sensor->field[v]].decimals[wide];
+
+			p = hidItem(p, HID_ITEM_USAGE, sensor->dataUsage[v], 2);
+			p = hidItem(p, HID_ITEM_LOGICAL_MIN, wide ? (uint32_t)INT32_MIN : (uint32_t)INT16_MIN, 4);
+			p = hidItem(p, HID_ITEM_LOGICAL_MAX, wide ? INT32_MAX : INT16_MAX, 4);
+			p = hidItem(p, HID_ITEM_REPORT_SIZE, valueSize * 8, 1);
+			p = hidItem(p, HID_ITEM_REPORT_COUNT, 1, 1);
+			p = hidItem(p, HID_ITEM_UNIT_EXPONENT, exponent & 0x0F, 1);
+			p = hidItem(p, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+		}
+		p = hidItem(p, HID_ITEM_END_COLLECTION, 0, 0);
+	}
+}
+
+uint8_t *hidReportDescriptor(uint16_t *len)
+{
+	*len = sizeof(reportDesc);
+	return reportDesc;
+}
+
+/* Input report id from the sample, returns its length */
+static uint16_t hidInputReport(uint8_t id, const sample_t *sample, uint8_t *dst)
+{
+	const hidSensor_t *sensor = &hidSensor[id - 1];
+	uint8_t wide = (valueSize == 4);
+	uint8_t *p = dst;
+
+	*p++ = id;
+	for (uint8_t v = 0; v < sensor->count; v++) {
+		const hidScale_t *scale = &hidScale[sensor->field[v]];
+		int32_t value = toFixed(sample->value[sensor->field[v]] * scale->scale, scale->decimals[wide]).value;
+
+		if (!wide) {
+			value = (value > INT16_MAX) ? INT16_MAX : (value < INT16_MIN) ? INT16_MIN : value;
+		}
+		for (uint8_t b = 0; b < valueSize; b++) {
+			*p++ = (uint32_t)value >> (8 * b);
+		}
+	}
+	return p - dst;
+}
+
+/* GET_REPORT, from the USB ISR */
+int8_t hidGetReport(uint8_t type, uint8_t id, uint8_t *dst, uint16_t *len)
+{
+	const sample_t *sample = sampleLatest();
+
+	if (id < 1 || id > HID_SENSORS) {
+		return USBD_FAIL;
+	}
+	if (type == HID_REPORT_TYPE_FEATURE) {
+		dst[0] = id;
+		for (uint8_t b = 0; b < 4; b++) {
+			dst[1 + b] = thConfig.hidInterval >> (8 * b);
+		}
+		*len = HID_FEATURE_REPORT_SIZE;
+		return USBD_OK;
+	}
+	if (type == HID_REPORT_TYPE_INPUT && sample != NULL) {
+		*len = hidInputReport(id, sample, dst);
+		return USBD_OK;
+	}
+	return USBD_FAIL;
+}
+
+/* SET_REPORT, from the USB ISR. The interval is shared by all the sensors, 0 asks for the
+   fastest one. Not saved, like the JSON commands */
+int8_t hidSetReport(uint8_t type, uint8_t id, uint8_t *src, uint16_t len)
+{
+	uint32_t interval;
+
+	if (type != HID_REPORT_TYPE_FEATURE || id < 1 || id > HID_SENSORS || len < HID_FEATURE_REPORT_SIZE) {
+		return USBD_FAIL;
+	}
+	interval = src[1] | (src[2] << 8) | (src[3] << 16) | ((uint32_t)src[4] << 24);
+	if (interval < HID_INTERVAL_MIN) {
+		interval = HID_INTERVAL_MIN;
+	} else if (interval > HID_INTERVAL_MAX) {
+		interval = HID_INTERVAL_MAX;
+	}
+	thConfig.hidInterval = interval;
+	return USBD_OK;
+}
+
+/* Sends input report nextId, the burst stops when the endpoint is busy (nobody polls it) */
+static void hidSendNext(void)
+{
+	const sample_t *sample = sampleLatest();
+	uint16_t len;
+
+	if (nextId == 0) {
+		return;
+	}
+	if (nextId > HID_SENSORS || sample == NULL) {
+		nextId = 0;
+		return;
+	}
+	len = hidInputReport(nextId, sample, report);
+	if (HID_SendReport_FS(report, len) != USBD_OK) {
+		nextId = 0;
+		return;
+	}
+	nextId++;
+}
+
+/* TIM2, every second: one burst of input reports, a report per sensor, every hidInterval ms */
+void hidTick(void)
+{
+	if (thConfig.hidInterval == 0) {
+		return;
+	}
+	if (elapsed < thConfig.hidInterval) {
+		elapsed += 1000;
+	}
+	if (elapsed >= thConfig.hidInterval) {
+		elapsed = 0;
+		nextId = 1;
+		hidSendNext();
+	}
+}
+
+/* USB ISR, the last input report is gone */
+void hidReportSent(void)
+{
+	hidSendNext();
+}
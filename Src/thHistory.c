@@ -0,0 +1,185 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include "main.h"
+#include "usbd_cdc_if.h"
+#include "thConfig.h"
+#include "thHistory.h"
+#include "flashLog.h"
+
+extern configs_t thConfig;
+
+/* Ring of packed samples, sample seq lives in ring[seq % HISTORY_LENGTH] */
+static uint8_t ring[HISTORY_LENGTH][PACKED_SAMPLE_SIZE];
+static volatile uint32_t lastSeq = 0;		/* 0: empty */
+
+/* Next sample to stream, 0 when there is no replay going on. The records come from
+   the RAM ring (replay) or the flash log (log dump), and go to the interface that asked
+   for them: the VCP in thConfig.format, the vendor interface as binary frames */
+typedef enum {
+	SOURCE_HISTORY = 0,
+	SOURCE_LOG
+} replaySource_t;
+
+static volatile uint32_t replaySeq = 0;
+static volatile replaySource_t replaySource = SOURCE_HISTORY;
+static volatile bool replayVendor = false;
+
+/* Main loop: stores a published sample, seq numbers must be consecutive */
+void historyAdd(const sample_t *sample)
+{
+	packSample(sample, ring[sample->seq % HISTORY_LENGTH]);
+	lastSeq = sample->seq;
+}
+
+uint32_t historyLastSeq(void)
+{
+	return lastSeq;
+}
+
+/* Oldest sample still in the ring, 0 if empty */
+uint32_t historyFirstSeq(void)
+{
+	uint32_t last = lastSeq;
+
+	if (last == 0) {
+		return 0;
+	}
+	return (last > HISTORY_LENGTH) ? last - HISTORY_LENGTH + 1 : 1;
+}
+
+/* Main loop only (the ring isn't written from interrupts) */
+bool historyGet(uint32_t seq, sample_t *sample)
+{
+	if (seq == 0 || seq < historyFirstSeq() || seq > lastSeq) {
+		return false;
+	}
+	unpackSample(ring[seq % HISTORY_LENGTH], sample);
+	sample->seq = seq;
+	sample->fieldMask = thConfig.fieldMask;
+	return true;
+}
+
+/* Command interface: streams every sample newer than since, starting with the oldest one kept.
+   Returns false if there is nothing newer */
+bool historyReplay(uint32_t since, bool vendor)
+{
+	uint32_t first = historyFirstSeq();
+
+	if (first == 0 || since >= lastSeq) {
+		return false;
+	}
+	replaySource = SOURCE_HISTORY;
+	replayVendor = vendor;
+	replaySeq = (since < first) ? first : since + 1;
+	return true;
+}
+
+/* Command interface: streams every flash log record newer than since (record index) */
+bool historyReplayLog(uint32_t since, bool vendor)
+{
+	uint32_t first = flashLogFirst();
+
+	if (first == 0 || since >= flashLogLast()) {
+		return false;
+	}
+	replaySource = SOURCE_LOG;
+	replayVendor = vendor;
+	replaySeq = (since < first) ? first : since + 1;
+	return true;
+}
+
+bool historyReplayActive(void)
+{
+	return replaySeq != 0;
+}
+
+/* First record at or after *seq. The log slots left empty by a reset are skipped */
+static bool replayGet(uint32_t *seq, sample_t *sample)
+{
+	if (replaySource == SOURCE_HISTORY) {
+		return historyGet(*seq, sample);
+	}
+	while (*seq <= flashLogLast()) {
+		if (flashLogGet(*seq, sample)) {
+			return true;
+		}
+		(*seq)++;
+	}
+	return false;
+}
+
+/* Main loop, idle time: queues replayed samples while the USB TX queue has room for them,
+   it keeps the bulk endpoint busy. The live reports are held back while replaying,
+   the replay catches up with them */
+void historyService(void)
+{
+	sample_t sample;
+
+	while (replaySeq != 0) {
+		uint32_t seq = replaySeq;
+		uint32_t next = seq;
+		bool vendor = replayVendor;
+		uint8_t *record;
+		uint16_t len;
+
+		if (!replayGet(&next, &sample)) {
+			/* done, or overrun by the ring */
+			bool log = (replaySource == SOURCE_LOG);
+			uint32_t last = log ? flashLogLast() : lastSeq;
+
+			__disable_irq();
+			if (replaySeq == seq) {
+				replaySeq = (next > last) ? 0 : (log ? flashLogFirst() : historyFirstSeq());
+			}
+			__enable_irq();
+			return;
+		}
+
+		/* serialized in place with the interrupts on, queued if the replay is still ours */
+		record = vendor ? VND_TxReserve_FS(BINARY_FRAME_MAX_SIZE) : CDC_TxReserve_FS(SERIALIZED_SAMPLE_MAX_SIZE);
+		if (record == NULL) {
+			return;
+		}
+		len = serializeSample(&sample, vendor ? BINARY : thConfig.format, true, (char *)record);
+		__disable_irq();
+		if (replaySeq != seq) {
+			/* restarted meanwhile from an interrupt */
+			__enable_irq();
+			if (vendor) {
+				VND_TxAbort_FS();
+			} else {
+				CDC_TxAbort_FS();
+			}
+			continue;
+		}
+		replaySeq = next + 1;
+		if (vendor) {
+			VND_TxCommit_FS(len);
+		} else {
+			CDC_TxCommit_FS(len);
+		}
+		__enable_irq();
+	}
+}
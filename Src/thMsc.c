@@ -0,0 +1,383 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "main.h"
+#include "usbd_cdc_if.h"
+#include "thMsc.h"
+#include "thDisk.h"
+
+#define CBW_SIGNATURE		0x43425355
+#define CSW_SIGNATURE		0x53425355
+#define CBW_SIZE			31
+#define CSW_SIZE			13
+#define CBW_FLAG_IN			0x80
+
+#define CSW_PASSED			0x00
+#define CSW_FAILED			0x01
+#define CSW_PHASE_ERROR		0x02
+
+/* SCSI operation codes */
+#define SCSI_TEST_UNIT_READY			0x00
+#define SCSI_REQUEST_SENSE				0x03
+#define SCSI_INQUIRY					0x12
+#define SCSI_MODE_SENSE_6				0x1A
+#define SCSI_START_STOP_UNIT			0x1B
+#define SCSI_PREVENT_ALLOW_REMOVAL		0x1E
+#define SCSI_READ_FORMAT_CAPACITIES		0x23
+#define SCSI_READ_CAPACITY_10			0x25
+#define SCSI_READ_10					0x28
+#define SCSI_WRITE_10					0x2A
+#define SCSI_VERIFY_10					0x2F
+#define SCSI_MODE_SENSE_10				0x5A
+
+/* Sense keys and additional sense codes */
+#define SENSE_NONE				0x00
+#define SENSE_ILLEGAL_REQUEST	0x05
+#define SENSE_DATA_PROTECT		0x07
+#define ASC_INVALID_COMMAND		0x20
+#define ASC_LBA_OUT_OF_RANGE	0x21
+#define ASC_INVALID_FIELD		0x24
+#define ASC_WRITE_PROTECTED		0x27
+
+typedef enum {
+	MSC_IDLE = 0,	/* waiting for a command wrapper */
+	MSC_COMMAND,	/* wrapper received, for mscService() */
+	MSC_DATA,		/* command response on the way, the status follows */
+	MSC_READ,		/* READ(10): the blocks go out one by one from mscService() */
+	MSC_STATUS,		/* status wrapper on the way */
+	MSC_HALT_IN,	/* IN halted, the status goes once the host clears it */
+	MSC_ERROR		/* invalid wrapper, both endpoints halted until a reset recovery */
+} mscState_t;
+
+static const uint8_t inquiryData[36] = {
+	0x00,			/* direct access block device */
+	0x80,			/* removable */
+	0x02, 0x02,		/* SPC-2 */
+	36 - 5,			/* additional length */
+	0x00, 0x00, 0x00,
+	'O', 'h', 'm', 'T', 'e', 'c', 'h', ' ',
+	'u', 'T', 'h', 'i', 'n', 'g', 'V', 'O', 'C', ' ', 'l', 'o', 'g', ' ', ' ', ' ',
+	'1', '.', '0', ' ',
+};
+
+static volatile mscState_t state = MSC_IDLE;
+static volatile bool remount = true;
+static volatile bool blockBusy = false;
+
+static uint8_t buffer[DISK_BLOCK_SIZE];		/* command wrapper in, then the response or a block */
+static uint8_t cbw[CBW_SIZE];
+static uint8_t csw[CSW_SIZE];
+static uint32_t residue;					/* bytes the host asked for and didn't get */
+static uint8_t status;
+static uint32_t readBlock;
+static uint16_t readCount;
+static uint8_t senseKey = SENSE_NONE;
+static uint8_t senseCode;
+
+static uint32_t get32(const uint8_t *src)
+{
+	return src[0] | (src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static void put32(uint8_t *dst, uint32_t value)
+{
+	for (uint8_t i = 0; i < 4; i++, value >>= 8) {
+		dst[i] = value & 0xFF;
+	}
+}
+
+/* SCSI fields are big endian */
+static uint32_t get32be(const uint8_t *src)
+{
+	return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | (src[2] << 8) | src[3];
+}
+
+static void put32be(uint8_t *dst, uint32_t value)
+{
+	for (int8_t i = 3; i >= 0; i--, value >>= 8) {
+		dst[i] = value & 0xFF;
+	}
+}
+
+/* From the USB interrupt or with it masked, the stack isn't reentrant. Nothing goes
+   out after a reset that came while the main loop was on the command */
+static void transmit(mscState_t next, uint8_t *data, uint16_t len)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	if (state != MSC_IDLE) {
+		state = next;
+		MSC_Transmit_FS(data, len);
+	}
+	__set_PRIMASK(primask);
+}
+
+static void sendStatus(void)
+{
+	put32(&csw[0], CSW_SIGNATURE);
+	memcpy(&csw[4], &cbw[4], 4);		/* tag */
+	put32(&csw[8], residue);
+	csw[12] = status;
+	transmit(MSC_STATUS, csw, CSW_SIZE);
+}
+
+/* Data stage refused. IN: the status goes once the host clears the halt */
+static void halt(uint8_t ep)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	if (state != MSC_IDLE) {
+		if (ep == MSC_IN_EP) {
+			state = MSC_HALT_IN;
+		}
+		MSC_Stall_FS(ep);
+	}
+	__set_PRIMASK(primask);
+}
+
+static void fail(uint8_t key, uint8_t code)
+{
+	status = CSW_FAILED;
+	senseKey = key;
+	senseCode = code;
+}
+
+/* Sends len bytes of response from buffer. The host may ask for less, or for more:
+   a response shorter than a packet ends the data stage by itself */
+static void respond(uint16_t len, uint32_t length, bool dataIn)
+{
+	if (status == CSW_PASSED && len > 0 && length > 0 && dataIn) {
+		if (len > length) {
+			len = length;
+		}
+		residue = length - len;
+		transmit(MSC_DATA, buffer, len);
+		return;
+	}
+	if (length == 0) {
+		sendStatus();
+	} else if (dataIn) {
+		halt(MSC_IN_EP);
+	} else {
+		/* OUT data stage, the status follows straight away */
+		status = CSW_FAILED;
+		halt(MSC_OUT_EP);
+		sendStatus();
+	}
+}
+
+/* The command in cbw[], main loop */
+static void command(void)
+{
+	const uint8_t *cb = &cbw[15];
+	uint32_t length = get32(&cbw[8]);
+	bool dataIn = (cbw[12] & CBW_FLAG_IN) != 0;
+	uint16_t len = 0;
+
+	residue = length;
+	status = CSW_PASSED;
+	if (cb[0] != SCSI_REQUEST_SENSE) {
+		senseKey = SENSE_NONE;
+		senseCode = 0;
+	}
+	memset(buffer, 0, sizeof(buffer));
+
+	switch (cb[0]) {
+	case SCSI_TEST_UNIT_READY:
+	case SCSI_PREVENT_ALLOW_REMOVAL:
+	case SCSI_VERIFY_10:
+		break;
+	case SCSI_START_STOP_UNIT:
+		if ((cb[4] & 0x03) == 0x03) {
+			/* load: the log as it is now */
+			diskSnapshot();
+		}
+		break;
+	case SCSI_REQUEST_SENSE:
+		buffer[0] = 0x70;		/* current errors, fixed format */
+		buffer[2] = senseKey;
+		buffer[7] = 18 - 8;
+		buffer[12] = senseCode;
+		len = 18;
+		senseKey = SENSE_NONE;
+		senseCode = 0;
+		break;
+	case SCSI_INQUIRY:
+		if (cb[1] & 0x01) {
+			/* no vital product data pages */
+			fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_FIELD);
+			break;
+		}
+		memcpy(buffer, inquiryData, sizeof(inquiryData));
+		len = sizeof(inquiryData);
+		break;
+	case SCSI_MODE_SENSE_6:
+		buffer[0] = 4 - 1;		/* mode data length */
+		buffer[2] = 0x80;		/* write protected */
+		len = 4;
+		break;
+	case SCSI_MODE_SENSE_10:
+		buffer[1] = 8 - 2;
+		buffer[3] = 0x80;
+		len = 8;
+		break;
+	case SCSI_READ_FORMAT_CAPACITIES:
+		buffer[3] = 8;			/* capacity list length */
+		put32be(&buffer[4], DISK_BLOCKS);
+		put32be(&buffer[8], DISK_BLOCK_SIZE);
+		buffer[8] = 0x02;		/* formatted media */
+		len = 12;
+		break;
+	case SCSI_READ_CAPACITY_10:
+		put32be(&buffer[0], DISK_BLOCKS - 1);
+		put32be(&buffer[4], DISK_BLOCK_SIZE);
+		len = 8;
+		break;
+	case SCSI_READ_10:
+		readBlock = get32be(&cb[2]);
+		readCount = (cb[7] << 8) | cb[8];
+		if (readBlock >= DISK_BLOCKS || readCount > DISK_BLOCKS - readBlock) {
+			fail(SENSE_ILLEGAL_REQUEST, ASC_LBA_OUT_OF_RANGE);
+			break;
+		}
+		if (!dataIn && length > 0) {
+			fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_FIELD);
+			break;
+		}
+		if ((uint32_t)readCount * DISK_BLOCK_SIZE > length) {
+			/* the host expects less than the blocks (Hn < Di, Hi < Di): no data, the host
+			   does a reset recovery on the phase error */
+			status = CSW_PHASE_ERROR;
+			break;
+		}
+		__disable_irq();
+		if (state == MSC_COMMAND) {
+			state = MSC_READ;
+		}
+		__enable_irq();
+		return;
+	case SCSI_WRITE_10:
+		fail(SENSE_DATA_PROTECT, ASC_WRITE_PROTECTED);
+		break;
+	default:
+		fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_COMMAND);
+		break;
+	}
+	respond(len, length, dataIn);
+}
+
+/* Configuration or bulk-only mass storage reset: waiting for a command again.
+   The log is taken again for the next mount */
+int8_t mscReset(void)
+{
+	state = MSC_IDLE;
+	remount = true;
+	blockBusy = false;
+	MSC_Receive_FS(buffer, MSC_PACKET_SIZE);
+	return USBD_OK;
+}
+
+/* USB interrupt, a transfer on the OUT endpoint: always a command wrapper,
+   there is no OUT data stage on a read-only volume */
+int8_t mscReceive(uint32_t len)
+{
+	if (state != MSC_IDLE) {
+		return USBD_OK;
+	}
+	if (len != CBW_SIZE || get32(buffer) != CBW_SIGNATURE || buffer[14] > 16) {
+		/* not meaningful: halt both until the host does a reset recovery */
+		state = MSC_ERROR;
+		MSC_Stall_FS(MSC_IN_EP);
+		MSC_Stall_FS(MSC_OUT_EP);
+		return USBD_OK;
+	}
+	memcpy(cbw, buffer, CBW_SIZE);
+	state = MSC_COMMAND;
+	return USBD_OK;
+}
+
+/* USB interrupt, the host cleared a halt. Only a reset ends MSC_ERROR */
+int8_t mscClearHalt(uint8_t ep)
+{
+	if (state == MSC_ERROR) {
+		MSC_Stall_FS(ep);
+	} else if (state == MSC_HALT_IN && ep == MSC_IN_EP) {
+		sendStatus();
+	}
+	return USBD_OK;
+}
+
+/* USB interrupt, the IN transfer is done */
+void mscDataSent(void)
+{
+	switch (state) {
+	case MSC_DATA:
+		sendStatus();
+		break;
+	case MSC_STATUS:
+		state = MSC_IDLE;
+		MSC_Receive_FS(buffer, MSC_PACKET_SIZE);
+		break;
+	case MSC_READ:
+		/* the next one, or the status, from mscService() */
+		blockBusy = false;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Main loop: the commands, and the READ(10) blocks one at a time */
+void mscService(void)
+{
+	if (state == MSC_COMMAND) {
+		if (remount) {
+			remount = false;
+			diskSnapshot();
+		}
+		command();
+	}
+	if (state != MSC_READ || blockBusy) {
+		return;
+	}
+	if (readCount == 0) {
+		/* a host asking for more than the blocks gets the halt */
+		if (residue > 0) {
+			halt(MSC_IN_EP);
+		} else {
+			sendStatus();
+		}
+		return;
+	}
+	diskRead(readBlock, buffer);
+	readBlock++;
+	readCount--;
+	residue -= DISK_BLOCK_SIZE;
+	blockBusy = true;
+	transmit(MSC_READ, buffer, DISK_BLOCK_SIZE);
+}
@@ -0,0 +1,715 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "thOutput.h"
+#include "bsec_datatypes.h"
+
+static const uint32_t POW10[] = {1, 10, 100, 1000, 10000};
+
+/* Adding a field: a row here with its BIN_ size, an entry in field_t and its value in output_ready() */
+
+/* fieldTable[].binSize, named so that PACKED_SAMPLE_SIZE can be checked at compile time */
+enum {
+	BIN_TEMPERATURE = 2, BIN_PRESSURE = 4, BIN_HUMIDITY = 2, BIN_GAS = 4,
+	BIN_IAQ = 2, BIN_ACCURACY = 1, BIN_CO2 = 4, BIN_VOC = 4,
+};
+
+_Static_assert(FIELD_COUNT == 8, "a new field needs its BIN_ size in the sum below");
+_Static_assert(PACKED_SAMPLE_SIZE == 4 + BIN_TEMPERATURE + BIN_PRESSURE + BIN_HUMIDITY + BIN_GAS +
+			   BIN_IAQ + BIN_ACCURACY + BIN_CO2 + BIN_VOC, "PACKED_SAMPLE_SIZE doesn't match fieldTable");
+
+const fieldDesc_t fieldTable[FIELD_COUNT] = {
+	/*  name             key    label                    unit    bsecId                                           div  json text width humanFlags      bin              binDec */
+	{ "temperature",   "t",   "Temperature",           "C",    BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE, 1,   2,   2,   0,    0,              BIN_TEMPERATURE, 2 },
+	{ "pressure",      "p",   "Pressure",              "hPa",  BSEC_OUTPUT_RAW_PRESSURE,                        100, 2,   2,   0,    0,              BIN_PRESSURE,    0 },
+	{ "humidity",      "rh",  "Humidity",              "%rH",  BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY,    1,   2,   2,   0,    0,              BIN_HUMIDITY,    2 },
+	{ "gasResistance", "gas", "Gas resistance",        "ohms", BSEC_OUTPUT_RAW_GAS,                             1,   0,   0,   6,    0,              BIN_GAS,         0 },
+	{ "IAQ",           "iaq", "IAQ",                   "",     BSEC_OUTPUT_IAQ,                                 1,   1,   1,   0,    0,              BIN_IAQ,         1 },
+	{ "iaqAccuracy",   "acc", "IAQ Accuracy",          "",     BSEC_OUTPUT_IAQ,                                 1,   0,   0,   0,    0,              BIN_ACCURACY,    0 },
+	{ "eqCO2",         "co2", "CO2equivalent",         "",     BSEC_OUTPUT_CO2_EQUIVALENT,                      1,   2,   1,   0,    0,              BIN_CO2,         2 },
+	{ "eqBreathVOC",   "voc", "Breath VOC equivalent", "",     BSEC_OUTPUT_BREATH_VOC_EQUIVALENT,               1,   2,   2,   0,    FMT_SPACE_SIGN, BIN_VOC,         2 },
+};
+
+/* sampleSlot[published] belongs to the reporter, the other one to the producer */
+static sample_t sampleSlot[2];
+static volatile int8_t published = -1;
+
+/* Incremental COBS encoder, so the CRC doesn't need to be appended to the payload first */
+typedef struct {
+	uint8_t *dst;
+	uint8_t *code;
+	uint16_t len;
+} cobs_t;
+
+static void cobsStart(cobs_t *c, uint8_t *dst)
+{
+	c->dst = dst;
+	c->code = dst;
+	c->len = 1;
+	*c->code = 1;
+}
+
+static void cobsPut(cobs_t *c, uint8_t byte)
+{
+	if (byte != 0) {
+		c->dst[c->len++] = byte;
+		(*c->code)++;
+	}
+	if (byte == 0 || *c->code == 0xFF) {
+		/* close the current block and open a new one */
+		c->code = &c->dst[c->len++];
+		*c->code = 1;
+	}
+}
+
+/* Exact float -> scaled integer conversion, done on the IEEE754 bits (no soft-float calls).
+   Rounds to nearest, ties to even, the same as printf("%.Nf") on the promoted double.
+   NaN and infinite values are clamped (BSEC never reports them). */
+fixed_t toFixed(float value, uint8_t decimals)
+{
+	fixed_t fixed;
+	uint32_t bits;
+	int32_t exponent;
+	uint64_t scaled;
+
+	memcpy(&bits, &value, sizeof(bits));
+	fixed.negative = (bits >> 31) != 0;
+
+	exponent = (bits >> 23) & 0xFF;
+	bits &= 0x007FFFFF;
+	if (exponent == 0xFF) {
+		scaled = INT32_MAX;
+	} else {
+		if (exponent == 0) {
+			exponent = 1; /* subnormal */
+		} else {
+			bits |= 0x00800000;
+		}
+		exponent -= 150; /* value = bits * 2^exponent */
+
+		scaled = (uint64_t)bits * POW10[decimals];
+		if (exponent >= 0) {
+			scaled = (exponent > 24) ? INT32_MAX : (scaled << exponent);
+		} else if (exponent < -63) {
+			scaled = 0;
+		} else {
+			uint64_t rem  = scaled & ((1ULL << -exponent) - 1);
+			uint64_t half = 1ULL << (-exponent - 1);
+
+			scaled >>= -exponent;
+			if (rem > half || (rem == half && (scaled & 1))) {
+				scaled++;
+			}
+		}
+		if (scaled > INT32_MAX) {
+			scaled = INT32_MAX;
+		}
+	}
+
+	fixed.value = fixed.negative ? -(int32_t)scaled : (int32_t)scaled;
+	return fixed;
+}
+
+/* Render digits backwards, returns the number of characters */
+static uint8_t utoaRev(char *end, uint32_t value, uint8_t minDigits)
+{
+	uint8_t n = 0;
+
+	do {
+		*--end = '0' + (value % 10);
+		value /= 10;
+		n++;
+	} while (value || n < minDigits);
+
+	return n;
+}
+
+/* Equivalent to sprintf("%<width>.<decimals>f") of the value toFixed() was built from */
+char *fmtFixed(char *dst, fixed_t fixed, uint8_t decimals, uint8_t width, uint8_t flags)
+{
+	char tmp[16];
+	char *end = tmp + sizeof(tmp);
+	uint32_t mag = fixed.negative ? -fixed.value : fixed.value;
+	uint8_t len;
+
+	if (decimals) {
+		len = utoaRev(end, mag % POW10[decimals], decimals);
+		tmp[sizeof(tmp) - len - 1] = '.';
+		len++;
+		len += utoaRev(end - len, mag / POW10[decimals], 1);
+	} else {
+		len = utoaRev(end, mag, 1);
+	}
+
+	if (fixed.negative) {
+		tmp[sizeof(tmp) - ++len] = '-';
+	} else if (flags & FMT_SPACE_SIGN) {
+		tmp[sizeof(tmp) - ++len] = ' ';
+	}
+
+	while (width > len) {
+		*dst++ = ' ';
+		width--;
+	}
+	memcpy(dst, end - len, len);
+	return dst + len;
+}
+
+/* sprintf("%u") */
+char *fmtUint(char *dst, uint32_t value)
+{
+	char tmp[10];
+	uint8_t len = utoaRev(tmp + sizeof(tmp), value, 1);
+
+	memcpy(dst, tmp + sizeof(tmp) - len, len);
+	return dst + len;
+}
+
+/* strcpy() returning the end of the string, the terminator isn't written */
+char *fmtStr(char *dst, const char *str)
+{
+	while (*str) {
+		*dst++ = *str++;
+	}
+	return dst;
+}
+
+/* Binary writer: COBS encodes and updates the CRC on the fly */
+typedef struct {
+	cobs_t		cobs;
+	uint16_t	crc;
+} binWriter_t;
+
+static void binPut(binWriter_t *w, uint32_t value, uint8_t size)
+{
+	while (size--) {
+		w->crc = crc16Update(w->crc, value & 0xFF);
+		cobsPut(&w->cobs, value & 0xFF);
+		value >>= 8;
+	}
+}
+
+/* CBOR (RFC 8949) major types */
+#define CBOR_UINT		0x00
+#define CBOR_NEGINT		0x20
+#define CBOR_TEXT		0x60
+#define CBOR_MAP		0xA0
+#define CBOR_FLOAT32	0xFA
+
+/* Item head with the shortest argument encoding, big endian */
+static char *cborHead(char *p, uint8_t major, uint32_t arg)
+{
+	uint8_t bytes;
+
+	if (arg < 24) {
+		*p++ = major | arg;
+		return p;
+	} else if (arg <= 0xFF) {
+		*p++ = major | 24;
+		bytes = 1;
+	} else if (arg <= 0xFFFF) {
+		*p++ = major | 25;
+		bytes = 2;
+	} else {
+		*p++ = major | 26;
+		bytes = 4;
+	}
+	while (bytes--) {
+		*p++ = arg >> (8 * bytes);
+	}
+	return p;
+}
+
+static char *cborText(char *p, const char *str)
+{
+	p = cborHead(p, CBOR_TEXT, strlen(str));
+	return fmtStr(p, str);
+}
+
+/* Integers for the fields without decimals, the raw float32 bits otherwise (no conversion at all) */
+static char *cborValue(char *p, float value, const fieldDesc_t *field)
+{
+	uint32_t bits;
+
+	if (field->jsonDecimals == 0) {
+		fixed_t fixed = toFixed(value, 0);
+
+		return fixed.value < 0 ? cborHead(p, CBOR_NEGINT, -1 - fixed.value)
+							   : cborHead(p, CBOR_UINT, fixed.value);
+	}
+	memcpy(&bits, &value, sizeof(bits));
+	*p++ = CBOR_FLOAT32;
+	for (int8_t shift = 24; shift >= 0; shift -= 8) {
+		*p++ = bits >> shift;
+	}
+	return p;
+}
+
+/* Text rendering of a field value: unit scaling, then the JSON or CSV/HUMAN resolution */
+static char *fmtField(char *p, float value, const fieldDesc_t *field, outFormat_t format)
+{
+	uint8_t decimals = (format == JSON) ? field->jsonDecimals : field->textDecimals;
+
+	if (field->divisor != 1) {
+		value /= field->divisor;
+	}
+	return fmtFixed(p, toFixed(value, decimals), decimals, field->width, (format == HUMAN) ? field->humanFlags : 0);
+}
+
+/* Walks fieldTable[] once, rendering every field straight into dst. Returns the output length.
+   The text formats are the same, byte for byte, as the former sprintf() ones:
+   JSON:  {"temperature": %.2f, ..., "gasResistance": %6.0f, "IAQ": %.1f, "iaqAccuracy": %u, "eqCO2": %.2f, "eqBreathVOC": %.2f}
+   CSV:   %.2f, %.2f, %.2f, %6.0f, %.1f, %u, %.1f, %.2f,
+   HUMAN: Temperature: %.2f C, Pressure: %.2f hPa, ..., CO2equivalent: %.1f, Breath VOC equivalent: % .2f
+   BINARY: [COBS(record + CRC16)] [0x00], record as described above SAMPLE_RECORD_MAX_SIZE
+   CBOR:  a map per sample with the short keys and the JSON units, items back to back (RFC 8742 CBOR sequence)
+   Only the fields in sample->fieldMask are rendered (the binary record then carries the mask).
+   withSeq prepends the sequence number and the timestamp (ms) to the text and CBOR formats,
+   the binary record always has them. JSON and BINARY carry the USB host time too, when known:
+   "sof" (frame) and "sofUs" (us into it), RECORD_FLAG_SOF set in the record type */
+uint16_t serializeSample(const sample_t *sample, outFormat_t format, bool withSeq, char *dst)
+{
+	char *p = dst;
+	binWriter_t bin;
+	uint16_t mask = sample->fieldMask;
+	bool first = !withSeq;
+
+	switch (format) {
+	case JSON:
+		*p++ = '{';
+		if (withSeq) {
+			p = fmtStr(p, "\"seq\": ");
+			p = fmtUint(p, sample->seq);
+			p = fmtStr(p, ", \"timestamp\": ");
+			p = fmtUint(p, sample->timestamp);
+			if (sample->sof.offset != SOF_OFFSET_INVALID) {
+				p = fmtStr(p, ", \"sof\": ");
+				p = fmtUint(p, sample->sof.frame);
+				p = fmtStr(p, ", \"sofUs\": ");
+				p = fmtUint(p, sample->sof.offset);
+			}
+		}
+		break;
+	case CSV:
+		if (withSeq) {
+			p = fmtUint(p, sample->seq);
+			p = fmtStr(p, ", ");
+			p = fmtUint(p, sample->timestamp);
+		}
+		break;
+	case HUMAN:
+		if (withSeq) {
+			p = fmtStr(p, "Seq: ");
+			p = fmtUint(p, sample->seq);
+			p = fmtStr(p, ", Timestamp: ");
+			p = fmtUint(p, sample->timestamp);
+			p = fmtStr(p, " ms");
+		}
+		break;
+	case CBOR:
+		{
+			uint8_t count = withSeq ? 2 : 0;
+
+			for (uint16_t m = mask; m; m &= m - 1) {
+				count++;
+			}
+			p = cborHead(p, CBOR_MAP, count);
+		}
+		if (withSeq) {
+			p = cborText(p, "seq");
+			p = cborHead(p, CBOR_UINT, sample->seq);
+			p = cborText(p, "ts");
+			p = cborHead(p, CBOR_UINT, sample->timestamp);
+		}
+		break;
+	case BINARY:
+		cobsStart(&bin.cobs, (uint8_t *)dst);
+		bin.crc = 0xFFFF;
+		{
+			bool sof = (sample->sof.offset != SOF_OFFSET_INVALID);
+			uint8_t type = (mask == FIELD_MASK_ALL) ? RECORD_TYPE_SAMPLE : RECORD_TYPE_SAMPLE_MASK;
+
+			binPut(&bin, sof ? (type | RECORD_FLAG_SOF) : type, 1);
+			binPut(&bin, sample->seq, 4);
+			binPut(&bin, sample->timestamp, 4);
+			if (sof) {
+				binPut(&bin, sample->sof.frame, 4);
+				binPut(&bin, sample->sof.offset, 2);
+			}
+		}
+		if (mask != FIELD_MASK_ALL) {
+			binPut(&bin, mask, 2);
+		}
+		break;
+	}
+
+	for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+		const fieldDesc_t *field = &fieldTable[i];
+		float value = sample->value[i];
+
+		if (!(mask & (1 << i))) {
+			continue;
+		}
+		if (format == BINARY) {
+			binPut(&bin, (uint32_t)toFixed(value, field->binDecimals).value, field->binSize);
+			continue;
+		}
+		if (format == CBOR) {
+			p = cborText(p, field->key);
+			p = cborValue(p, (field->divisor != 1) ? value / field->divisor : value, field);
+			continue;
+		}
+
+		if (!first) {
+			p = fmtStr(p, ", ");
+		}
+		first = false;
+		if (format == JSON) {
+			*p++ = '"';
+			p = fmtStr(p, field->name);
+			p = fmtStr(p, "\": ");
+		} else if (format == HUMAN) {
+			p = fmtStr(p, field->label);
+			p = fmtStr(p, ": ");
+		}
+		p = fmtField(p, value, field, format);
+
+		if (format == HUMAN && field->unit[0]) {
+			*p++ = ' ';
+			p = fmtStr(p, field->unit);
+		}
+	}
+
+	switch (format) {
+	case JSON:
+		p = fmtStr(p, "}\r\n");
+		break;
+	case CSV:
+		p = fmtStr(p, ",\r\n");
+		break;
+	case HUMAN:
+		p = fmtStr(p, "\r\n");
+		break;
+	case BINARY:
+		binPut(&bin, bin.crc, 2);
+		bin.cobs.dst[bin.cobs.len++] = 0x00;
+		return bin.cobs.len;
+	case CBOR:
+		return p - dst;
+	}
+	*p = '\0';
+
+	return p - dst;
+}
+
+static const char *STAT_NAME[] = { "min", "max", "mean", "sd", "last" };
+
+/* serializeStats() JSON worst case, withLast: 10 digits for the counts, and for every value
+   a sign, 10 digits and the point (no point with 0 decimals). Names and decimals as in fieldTable[] */
+#define STATS_JSON_HEADER		(sizeof("{\"stats\": {\"n\": , \"from\": , \"to\": ") - 1 + 3 * 10)
+#define STATS_JSON_FIELD(name, decimals) \
+	(sizeof(", \"" name "\": {}") - 1 + sizeof("\"min\": , \"max\": , \"mean\": , \"sd\": , \"last\": ") - 1 + \
+	 5 * (11 + ((decimals) > 0)))
+_Static_assert(STATS_JSON_HEADER + STATS_JSON_FIELD("temperature", 2) + STATS_JSON_FIELD("pressure", 2) +
+			   STATS_JSON_FIELD("humidity", 2) + STATS_JSON_FIELD("gasResistance", 0) + STATS_JSON_FIELD("IAQ", 1) +
+			   STATS_JSON_FIELD("iaqAccuracy", 0) + STATS_JSON_FIELD("eqCO2", 2) + STATS_JSON_FIELD("eqBreathVOC", 2) +
+			   sizeof("}}\r\n") <= SERIALIZED_STATS_MAX_SIZE, "SERIALIZED_STATS_MAX_SIZE below the JSON stats worst case");
+
+/* Window statistics, one record per window:
+   JSON:  {"stats": {"n": N, "from": ms, "to": ms, "temperature": {"min": .., "max": .., "mean": .., "sd": ..}, ...}}
+   CSV:   N, from, to, then min, max, mean, sd of every field,
+   HUMAN: a "Samples:" line, then a line per field
+   CBOR:  {"stats": {"n": N, "from": ms, "to": ms, "t": {"min": .., ...}, ...}}
+   BINARY: [COBS(record + CRC16)] [0x00], record: RECORD_TYPE_STATS, seq (u32), from (u32), to (u32),
+           count (u16), field mask (u16), flags (u8, bit 0: last), then min, max, mean, sd of every
+           field in the mask, each one encoded as the field in the sample record
+   withLast adds the last value of the window after sd. sd is the population standard deviation,
+   it has the unit (and the resolution) of the field itself */
+uint16_t serializeStats(const stats_t *stats, outFormat_t format, bool withLast, char *dst)
+{
+	char *p = dst;
+	binWriter_t bin;
+	uint16_t mask = stats->fieldMask;
+	uint8_t statCount = withLast ? 5 : 4;
+
+	switch (format) {
+	case JSON:
+		p = fmtStr(p, "{\"stats\": {\"n\": ");
+		p = fmtUint(p, stats->count);
+		p = fmtStr(p, ", \"from\": ");
+		p = fmtUint(p, stats->from);
+		p = fmtStr(p, ", \"to\": ");
+		p = fmtUint(p, stats->to);
+		break;
+	case CSV:
+		p = fmtUint(p, stats->count);
+		p = fmtStr(p, ", ");
+		p = fmtUint(p, stats->from);
+		p = fmtStr(p, ", ");
+		p = fmtUint(p, stats->to);
+		break;
+	case HUMAN:
+		p = fmtStr(p, "Samples: ");
+		p = fmtUint(p, stats->count);
+		p = fmtStr(p, ", From: ");
+		p = fmtUint(p, stats->from);
+		p = fmtStr(p, " ms, To: ");
+		p = fmtUint(p, stats->to);
+		p = fmtStr(p, " ms\r\n");
+		break;
+	case CBOR:
+		{
+			uint8_t count = 3;
+
+			for (uint16_t m = mask; m; m &= m - 1) {
+				count++;
+			}
+			p = cborHead(p, CBOR_MAP, 1);
+			p = cborText(p, "stats");
+			p = cborHead(p, CBOR_MAP, count);
+		}
+		p = cborText(p, "n");
+		p = cborHead(p, CBOR_UINT, stats->count);
+		p = cborText(p, "from");
+		p = cborHead(p, CBOR_UINT, stats->from);
+		p = cborText(p, "to");
+		p = cborHead(p, CBOR_UINT, stats->to);
+		break;
+	case BINARY:
+		cobsStart(&bin.cobs, (uint8_t *)dst);
+		bin.crc = 0xFFFF;
+		binPut(&bin, RECORD_TYPE_STATS, 1);
+		binPut(&bin, stats->seq, 4);
+		binPut(&bin, stats->from, 4);
+		binPut(&bin, stats->to, 4);
+		binPut(&bin, (stats->count > 0xFFFF) ? 0xFFFF : stats->count, 2);
+		binPut(&bin, mask, 2);
+		binPut(&bin, withLast ? 0x01 : 0x00, 1);
+		break;
+	}
+
+	for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+		const fieldDesc_t *field = &fieldTable[i];
+		float value[5];
+
+		if (!(mask & (1 << i))) {
+			continue;
+		}
+		value[0] = stats->min[i];
+		value[1] = stats->max[i];
+		value[2] = stats->mean[i];
+		value[3] = (stats->count > 0) ? sqrtf(stats->m2[i] / stats->count) : 0.0f;
+		value[4] = stats->last[i];
+
+		if (format == BINARY) {
+			for (uint8_t s = 0; s < statCount; s++) {
+				binPut(&bin, (uint32_t)toFixed(value[s], field->binDecimals).value, field->binSize);
+			}
+			continue;
+		}
+		if (format == CBOR) {
+			p = cborText(p, field->key);
+			p = cborHead(p, CBOR_MAP, statCount);
+			for (uint8_t s = 0; s < statCount; s++) {
+				p = cborText(p, STAT_NAME[s]);
+				p = cborValue(p, (field->divisor != 1) ? value[s] / field->divisor : value[s], field);
+			}
+			continue;
+		}
+
+		if (format == JSON) {
+			p = fmtStr(p, ", \"");
+			p = fmtStr(p, field->name);
+			p = fmtStr(p, "\": {");
+		} else if (format == HUMAN) {
+			p = fmtStr(p, field->label);
+			p = fmtStr(p, ": ");
+		}
+		for (uint8_t s = 0; s < statCount; s++) {
+			if (format == JSON) {
+				if (s > 0) {
+					p = fmtStr(p, ", ");
+				}
+				*p++ = '"';
+				p = fmtStr(p, STAT_NAME[s]);
+				p = fmtStr(p, "\": ");
+			} else if (format == HUMAN) {
+				if (s > 0) {
+					p = fmtStr(p, ", ");
+				}
+				p = fmtStr(p, STAT_NAME[s]);
+				*p++ = ' ';
+			} else {
+				p = fmtStr(p, ", ");
+			}
+			p = fmtField(p, value[s], field, format);
+		}
+		if (format == JSON) {
+			*p++ = '}';
+		} else if (format == HUMAN) {
+			if (field->unit[0]) {
+				*p++ = ' ';
+				p = fmtStr(p, field->unit);
+			}
+			p = fmtStr(p, "\r\n");
+		}
+	}
+
+	switch (format) {
+	case JSON:
+		p = fmtStr(p, "}}\r\n");
+		break;
+	case CSV:
+		p = fmtStr(p, ",\r\n");
+		break;
+	case HUMAN:
+		break;
+	case BINARY:
+		binPut(&bin, bin.crc, 2);
+		bin.cobs.dst[bin.cobs.len++] = 0x00;
+		return bin.cobs.len;
+	case CBOR:
+		return p - dst;
+	}
+	*p = '\0';
+
+	return p - dst;
+}
+
+/* Compact copy of a sample (no seq and mask), for the sample history. Returns the record length */
+uint8_t packSample(const sample_t *sample, uint8_t *dst)
+{
+	uint8_t *p = dst;
+
+	for (uint8_t shift = 0; shift < 32; shift += 8) {
+		*p++ = sample->timestamp >> shift;
+	}
+	for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+		uint32_t raw = (uint32_t)toFixed(sample->value[i], fieldTable[i].binDecimals).value;
+
+		for (uint8_t n = 0; n < fieldTable[i].binSize; n++, raw >>= 8) {
+			*p++ = raw & 0xFF;
+		}
+	}
+	return p - dst;
+}
+
+/* Back from packSample(), the values have the binary record resolution.
+   seq and fieldMask are left to the caller, the USB host time is not kept */
+void unpackSample(const uint8_t *src, sample_t *sample)
+{
+	sample->timestamp = src[0] | (src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+	sample->sof.frame = 0;
+	sample->sof.offset = SOF_OFFSET_INVALID;
+	src += 4;
+	for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+		uint8_t size = fieldTable[i].binSize;
+		uint32_t raw = 0;
+
+		for (uint8_t n = 0; n < size; n++) {
+			raw |= (uint32_t)src[n] << (8 * n);
+		}
+		src += size;
+		if (size < 4 && (raw & (1UL << (8 * size - 1)))) {
+			raw |= ~0UL << (8 * size); /* sign extension */
+		}
+		sample->value[i] = (float)(int32_t)raw / POW10[fieldTable[i].binDecimals];
+	}
+}
+
+/* Producer side (main loop): the slot to fill, never the one the reporter reads */
+sample_t *sampleWriteSlot(void)
+{
+	return &sampleSlot[published == 0 ? 1 : 0];
+}
+
+/* Producer side: makes the slot from sampleWriteSlot() the latest sample, never blocks */
+void samplePublish(void)
+{
+	/* the slot contents must be in memory before the index store */
+	__asm volatile ("" ::: "memory");
+	published = (published == 0) ? 1 : 0;
+}
+
+/* Reporter side: latest complete sample, NULL before the first one.
+   Consistent as long as the caller can't be preempted by the producer (interrupt context),
+   the pointer is only valid until it returns */
+const sample_t *sampleLatest(void)
+{
+	int8_t idx = published;
+
+	return (idx < 0) ? NULL : &sampleSlot[idx];
+}
+
+/* CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) */
+uint16_t crc16Update(uint16_t crc, uint8_t byte)
+{
+	crc ^= (uint16_t)byte << 8;
+	for (int i = 0; i < 8; i++) {
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+	return crc;
+}
+
+uint16_t crc16(const uint8_t *data, uint16_t len)
+{
+	uint16_t crc = 0xFFFF;
+
+	while (len--) {
+		crc = crc16Update(crc, *data++);
+	}
+	return crc;
+}
+
+/* Returns the encoded length (no delimiter). dst must hold len + len/254 + 1 bytes */
+uint16_t cobsEncode(const uint8_t *src, uint16_t len, uint8_t *dst)
+{
+	cobs_t c;
+
+	cobsStart(&c, dst);
+	while (len--) {
+		cobsPut(&c, *src++);
+	}
+	return c.len;
+}
+
+/* [COBS(payload + CRC16 little endian)] [0x00]. The frame can be built in place: payload may
+   start 4 bytes after dst (payloads up to 760 bytes), COBS never writes past what it has read */
+uint16_t binaryFrame(const uint8_t *payload, uint16_t len, uint8_t *dst)
+{
+	cobs_t c;
+	uint16_t crc = crc16(payload, len);
+
+	cobsStart(&c, dst);
+	while (len--) {
+		cobsPut(&c, *payload++);
+	}
+	cobsPut(&c, crc & 0xFF);
+	cobsPut(&c, crc >> 8);
+
+	dst[c.len++] = 0x00;
+	return c.len;
+}
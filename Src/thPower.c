@@ -0,0 +1,181 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include "main.h"
+#include "usbd_def.h"
+#include "thPower.h"
+
+extern RTC_HandleTypeDef hrtc;
+extern IWDG_HandleTypeDef watchdogHandle;
+extern USBD_HandleTypeDef hUsbDeviceFS;
+extern __IO uint32_t uwTick;
+
+#define RTC_CYCLES_PER_DAY		(86400UL * (RTC_SYNCH_PREDIV + 1))
+#define LSI_CALIBRATION_MS		200
+#define RTC_WAKEUP_DIVIDER		16		/* RTC_WAKEUPCLOCK_RTCCLK_DIV16 */
+#define CLOCK_RESTORE_POLLS		10000	/* ~10 ms on the HSI, the HSI48 starts in a few us */
+
+/* The LSI is only good to +-50 %: measured against SysTick, the BSEC time base, once per suspend */
+static uint32_t lsiHz = LSI_VALUE;
+static volatile bool lsiCalibrated = false;
+/* uwTick compensation, what's left of the last conversion (LSI cycles * 1000) */
+static uint32_t tickRemainder = 0;
+
+/* Time of day in LSI cycles, [0, RTC_CYCLES_PER_DAY) */
+static uint32_t rtcCycles(void)
+{
+	RTC_TimeTypeDef time;
+	RTC_DateTypeDef date;
+
+	/* the date read unlocks the shadow registers */
+	HAL_RTC_GetTime(&hrtc, &time, RTC_FORMAT_BIN);
+	HAL_RTC_GetDate(&hrtc, &date, RTC_FORMAT_BIN);
+	return ((time.Hours * 60UL + time.Minutes) * 60UL + time.Seconds) * (RTC_SYNCH_PREDIV + 1) +
+			(RTC_SYNCH_PREDIV - time.SubSeconds);
+}
+
+static uint32_t rtcElapsed(uint32_t from)
+{
+	uint32_t now = rtcCycles();
+
+	return (now >= from) ? now - from : now + RTC_CYCLES_PER_DAY - from;
+}
+
+static void lsiCalibrate(void)
+{
+	uint32_t start = HAL_GetTick();
+	uint32_t from;
+
+	/* from a tick edge */
+	while (HAL_GetTick() == start) {
+	}
+	start = HAL_GetTick();
+	from = rtcCycles();
+	while (HAL_GetTick() - start < LSI_CALIBRATION_MS) {
+	}
+	lsiHz = (uint64_t)rtcElapsed(from) * 1000 / LSI_CALIBRATION_MS;
+	lsiCalibrated = true;
+}
+
+/* Out of STOP the MCU runs on the HSI (8 MHz), the USB needs the HSI48 back. The flash latency,
+   the prescalers and the CRS setup survive STOP: only the oscillator and the switch, polled
+   with bounded loops as the tick doesn't run (interrupts off, or from the USB interrupt) */
+static void clockRestore(void)
+{
+	uint32_t polls;
+
+	if (__HAL_RCC_GET_SYSCLK_SOURCE() == RCC_SYSCLKSOURCE_STATUS_HSI48) {
+		return;
+	}
+	__HAL_RCC_HSI48_ENABLE();
+	for (polls = CLOCK_RESTORE_POLLS; __HAL_RCC_GET_FLAG(RCC_FLAG_HSI48RDY) == RESET; polls--) {
+		if (polls == 0) {
+			Error_Handler();
+			return;
+		}
+	}
+	__HAL_RCC_SYSCLK_CONFIG(RCC_SYSCLKSOURCE_HSI48);
+	for (polls = CLOCK_RESTORE_POLLS;
+			__HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_HSI48; polls--) {
+		if (polls == 0) {
+			Error_Handler();
+			return;
+		}
+	}
+}
+
+bool powerSuspended(void)
+{
+	return hUsbDeviceFS.dev_state == USBD_STATE_SUSPENDED;
+}
+
+/* user_delay_ms() while suspended: STOP mode until period ms are over or the bus resumes.
+   SysTick is stopped as well, uwTick is moved forward by the time slept (RTC), the BSEC
+   timestamps don't see the difference */
+void powerSleep(uint32_t period)
+{
+	uint32_t start = HAL_GetTick();
+
+	if (!lsiCalibrated) {
+		lsiCalibrate();
+	}
+	/* nobody is looking, and the suspend current budget is 2.5 mA */
+	HAL_GPIO_WritePin(BLUE_LED_GPIO_Port, BLUE_LED_Pin, GPIO_PIN_SET);
+	HAL_GPIO_WritePin(RED_LED_GPIO_Port, RED_LED_Pin, GPIO_PIN_SET);
+
+	for (;;) {
+		uint32_t elapsed = HAL_GetTick() - start;
+		uint32_t ms, from;
+		uint64_t slept;
+
+		if (!powerSuspended() || elapsed + POWER_STOP_MIN_MS > period) {
+			return;
+		}
+		ms = period - elapsed;
+		if (ms > POWER_STOP_MAX_MS) {
+			ms = POWER_STOP_MAX_MS;
+		}
+
+		HAL_IWDG_Refresh(&watchdogHandle);
+		HAL_RTCEx_SetWakeUpTimer_IT(&hrtc, (uint64_t)ms * lsiHz / (1000 * RTC_WAKEUP_DIVIDER) - 1,
+				RTC_WAKEUPCLOCK_RTCCLK_DIV16);
+		from = rtcCycles();
+
+		/* The interrupt that wakes us up only runs once the clocks are back. A resume
+		   before the WFI keeps it from sleeping */
+		__disable_irq();
+		if (!powerSuspended()) {
+			__enable_irq();
+			HAL_RTCEx_DeactivateWakeUpTimer(&hrtc);
+			return;
+		}
+		HAL_SuspendTick();
+		HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+		clockRestore();
+		HAL_ResumeTick();
+		__enable_irq();
+
+		HAL_RTCEx_DeactivateWakeUpTimer(&hrtc);
+		/* the shadow registers were frozen in STOP */
+		__HAL_RTC_WRITEPROTECTION_DISABLE(&hrtc);
+		HAL_RTC_WaitForSynchro(&hrtc);
+		__HAL_RTC_WRITEPROTECTION_ENABLE(&hrtc);
+
+		slept = (uint64_t)rtcElapsed(from) * 1000 + tickRemainder;
+		uwTick += slept / lsiHz;
+		tickRemainder = slept % lsiHz;
+	}
+}
+
+/* USB interrupt, bus suspended. The LSI drifts with the temperature: measured again next time */
+void powerSuspend(void)
+{
+	lsiCalibrated = false;
+}
+
+/* USB interrupt, bus resumed: possibly woken up from STOP */
+void powerResume(void)
+{
+	clockRestore();
+}
@@ -0,0 +1,402 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <string.h>
+#include "main.h"
+#include "thProto.h"
+#include "thConfig.h"
+#include "thOutput.h"
+#include "thHistory.h"
+#include "thHid.h"
+#include "thBsec.h"
+#include "flashLog.h"
+#include "flashSave.h"
+#include "version.h"
+#include "usbd_cdc_if.h"
+
+extern configs_t thConfig;
+
+/* How a TLV value maps to the device */
+enum {
+	KIND_UINT,			/* thConfig member, width bytes */
+	KIND_CENTI,			/* thConfig float, value / 100 */
+	KIND_DEADBAND,		/* thConfig.deadband[], KIND_CENTI per field */
+	KIND_SERIAL,
+	KIND_VERSION,
+	KIND_READ,			/* read(), read only */
+	KIND_ACTION,		/* no value */
+	KIND_STATE,			/* BSEC state length and CRC, write: import */
+	KIND_STATE_CHUNK,	/* BSEC state bytes */
+};
+
+typedef struct {
+	uint8_t		tag;
+	uint8_t		size;		/* value bytes */
+	uint8_t		kind;
+	uint8_t		width;		/* KIND_UINT: bytes of the thConfig member */
+	void		*setting;	/* NULL: read only, but for the state kinds */
+	int32_t		min;
+	int32_t		max;		/* min < 0: the value is signed */
+	bool		zeroOff;	/* 0 is valid too, it turns the feature off */
+	uint32_t	(*read)(void);
+} tlvDesc_t;
+
+#define SETTING(member)		.setting = &thConfig.member, .width = sizeof(thConfig.member)
+#define STATE_CHUNK(n)		{ .tag = TAG_STATE_CHUNK + (n), .size = STATE_CHUNK_SIZE, .kind = KIND_STATE_CHUNK }
+
+_Static_assert(STATE_CHUNKS * STATE_CHUNK_SIZE >= BSEC_MAX_STATE_BLOB_SIZE, "the chunks hold the whole state");
+
+static uint32_t stateStatus(void)
+{
+	uint16_t len, crc;
+
+	return bsec_iot_state_status(&len, &crc);
+}
+
+static const tlvDesc_t tlvTable[] = {
+	{ .tag = TAG_REPORTING_PERIOD,   .size = 2, .kind = KIND_UINT, SETTING(reportingPeriod), .min = 1, .max = 3600 },
+	{ .tag = TAG_FORMAT,             .size = 1, .kind = KIND_UINT, SETTING(format), .min = JSON, .max = CBOR },
+	{ .tag = TAG_LED,                .size = 1, .kind = KIND_UINT, SETTING(ledEnabled), .min = 0, .max = 1 },
+	{ .tag = TAG_TEMPERATURE_OFFSET, .size = 2, .kind = KIND_CENTI, .setting = &thConfig.temperatureOffset, .min = -1500, .max = 1500 },
+	{ .tag = TAG_FIELDS,             .size = 2, .kind = KIND_UINT, SETTING(fieldMask), .min = 1, .max = FIELD_MASK_ALL },
+	{ .tag = TAG_REPORT,             .size = 1, .kind = KIND_UINT, SETTING(reportMode), .min = 0, .max = REPORT_MODES - 1 },
+	{ .tag = TAG_STATS_LAST,         .size = 1, .kind = KIND_UINT, SETTING(statsLast), .min = 0, .max = 1 },
+	{ .tag = TAG_LOG_PERIOD,         .size = 2, .kind = KIND_UINT, SETTING(logPeriod), .min = LOG_PERIOD_MIN, .max = UINT16_MAX, .zeroOff = true },
+	{ .tag = TAG_CATCH_UP,           .size = 1, .kind = KIND_UINT, SETTING(catchUp), .min = 0, .max = 1 },
+	{ .tag = TAG_HID_INTERVAL,       .size = 4, .kind = KIND_UINT, SETTING(hidInterval), .min = HID_INTERVAL_MIN, .max = HID_INTERVAL_MAX, .zeroOff = true },
+	{ .tag = TAG_HID_SIZE,           .size = 1, .kind = KIND_UINT, SETTING(hidValueSize), .min = 2, .max = 4 },
+	{ .tag = TAG_DEADBAND,           .size = 4 * FIELD_COUNT, .kind = KIND_DEADBAND, .setting = thConfig.deadband, .min = 0, .max = 10000000 },
+	{ .tag = TAG_SAMPLE_RATE,        .size = 1, .kind = KIND_UINT, SETTING(sampleRate), .min = SAMPLE_RATE_LP, .max = SAMPLE_RATE_ULP },
+	{ .tag = TAG_STATE,              .size = 4, .kind = KIND_STATE, .min = 1, .max = BSEC_MAX_STATE_BLOB_SIZE },
+	{ .tag = TAG_VERSION,            .size = 3, .kind = KIND_VERSION },
+	{ .tag = TAG_SERIAL,             .size = 16, .kind = KIND_SERIAL },
+	{ .tag = TAG_UPTIME,             .size = 4, .kind = KIND_READ, .read = HAL_GetTick },
+	{ .tag = TAG_SEQ,                .size = 4, .kind = KIND_READ, .read = historyLastSeq },
+	{ .tag = TAG_LOG,                .size = 4, .kind = KIND_READ, .read = flashLogLast },
+	{ .tag = TAG_STATE_STATUS,       .size = 1, .kind = KIND_READ, .read = stateStatus },
+	STATE_CHUNK(0),
+	STATE_CHUNK(1),
+	STATE_CHUNK(2),
+	{ .tag = TAG_SAVE,               .size = 0, .kind = KIND_ACTION },
+	{ .tag = TAG_MEASURE,            .size = 0, .kind = KIND_ACTION },
+	{ .tag = TAG_STATE_EXPORT,       .size = 0, .kind = KIND_ACTION },
+};
+
+#define TLV_COUNT	(sizeof(tlvTable) / sizeof(tlvTable[0]))
+
+/* Request being received, COBS decoded on the fly */
+static uint8_t request[PROTO_REQUEST_MAX];
+static uint8_t requestLen;
+static bool started = false;	/* a frame is coming in */
+static bool dropped;			/* too long or broken, skipped up to its delimiter */
+static uint8_t left;			/* data bytes left in the COBS block */
+static bool zeroNext;			/* the block ends with a 0x00, unless it's the last one */
+
+/* Response waiting for room in the vendor TX queue, payload without the CRC */
+static uint8_t response[PROTO_RESPONSE_MAX];
+static uint8_t responseLen = 0;
+
+static const tlvDesc_t *tlvFind(uint8_t tag)
+{
+	for (uint8_t n = 0; n < TLV_COUNT; n++) {
+		if (tlvTable[n].tag == tag) {
+			return &tlvTable[n];
+		}
+	}
+	return NULL;
+}
+
+static int32_t getInt(const uint8_t *src, uint8_t size, bool sign)
+{
+	uint32_t value = 0;
+
+	for (uint8_t n = 0; n < size; n++) {
+		value |= (uint32_t)src[n] << (8 * n);
+	}
+	if (sign && size < 4 && (value & (1UL << (8 * size - 1)))) {
+		value |= ~0UL << (8 * size);
+	}
+	return (int32_t)value;
+}
+
+static uint8_t *putInt(uint8_t *dst, uint32_t value, uint8_t size)
+{
+	for (uint8_t n = 0; n < size; n++) {
+		*dst++ = value >> (8 * n);
+	}
+	return dst;
+}
+
+static bool tlvValid(const tlvDesc_t *d, const uint8_t *value)
+{
+	uint8_t count = (d->kind == KIND_DEADBAND) ? FIELD_COUNT : 1;
+	uint8_t size = d->size / count;
+
+	if (d->kind == KIND_STATE_CHUNK) {
+		return true;
+	}
+	if (d->kind == KIND_STATE) {
+		/* the length, any CRC goes */
+		size = 2;
+	}
+	for (uint8_t n = 0; n < count; n++) {
+		int32_t x = getInt(value + n * size, size, d->min < 0);
+
+		if (!((d->zeroOff && x == 0) || (x >= d->min && x <= d->max))) {
+			return false;
+		}
+		if (d->tag == TAG_HID_SIZE && x == 3) {
+			/* 2 or 4 bytes per value */
+			return false;
+		}
+	}
+	return true;
+}
+
+static void tlvWrite(const tlvDesc_t *d, const uint8_t *value)
+{
+	/* thConfig is packed, the members are copied rather than dereferenced */
+	if (d->kind == KIND_UINT) {
+		uint32_t x = getInt(value, d->size, false);
+
+		memcpy(d->setting, &x, d->width);	/* little endian */
+	} else if (d->kind == KIND_STATE) {
+		bsec_iot_state_import(getInt(value, 2, false), getInt(value + 2, 2, false));
+	} else if (d->kind == KIND_STATE_CHUNK) {
+		bsec_iot_state_write((d->tag - TAG_STATE_CHUNK) * STATE_CHUNK_SIZE, value, d->size);
+	} else {
+		uint8_t count = (d->kind == KIND_DEADBAND) ? FIELD_COUNT : 1;
+		uint8_t size = d->size / count;
+
+		for (uint8_t n = 0; n < count; n++) {
+			float f = getInt(value + n * size, size, d->min < 0) / 100.0f;
+
+			memcpy((float *)d->setting + n, &f, sizeof(f));
+		}
+	}
+}
+
+static uint8_t *tlvRead(const tlvDesc_t *d, uint8_t *dst)
+{
+	*dst++ = d->tag;
+	*dst++ = d->size;
+
+	switch (d->kind) {
+		case KIND_UINT: {
+			uint32_t x = 0;
+
+			memcpy(&x, d->setting, d->width);
+			return putInt(dst, x, d->size);
+		}
+		case KIND_CENTI:
+		case KIND_DEADBAND: {
+			uint8_t count = (d->kind == KIND_DEADBAND) ? FIELD_COUNT : 1;
+			uint8_t size = d->size / count;
+
+			for (uint8_t n = 0; n < count; n++) {
+				float f;
+
+				memcpy(&f, (float *)d->setting + n, sizeof(f));
+				dst = putInt(dst, toFixed(f, 2).value, size);
+			}
+			return dst;
+		}
+		case KIND_SERIAL:
+			memcpy(dst, thConfig.serialNumberStr, d->size);
+			return dst + d->size;
+		case KIND_VERSION:
+			*dst++ = VERSION_MAJOR;
+			*dst++ = VERSION_MINOR;
+			*dst++ = VERSION_PATCH;
+			return dst;
+		case KIND_READ:
+			return putInt(dst, d->read(), d->size);
+		case KIND_STATE: {
+			uint16_t len, crc;
+
+			bsec_iot_state_status(&len, &crc);
+			dst = putInt(dst, len, 2);
+			return putInt(dst, crc, 2);
+		}
+		case KIND_STATE_CHUNK:
+			bsec_iot_state_read((d->tag - TAG_STATE_CHUNK) * STATE_CHUNK_SIZE, dst, d->size);
+			return dst + d->size;
+		default:
+			return dst;
+	}
+}
+
+/* Checks every TLV of the request. Returns the status, *fault the tag it's about */
+static uint8_t requestCheck(uint8_t end, uint8_t *fault)
+{
+	uint16_t reads = 0;
+
+	for (uint8_t pos = 3; pos < end; pos += 2 + request[pos + 1]) {
+		*fault = request[pos];
+		if (pos + 2 > end || pos + 2 + request[pos + 1] > end) {
+			return PROTO_MALFORMED;
+		}
+		const tlvDesc_t *d = tlvFind(request[pos]);
+		uint8_t len = request[pos + 1];
+
+		if (d == NULL) {
+			return PROTO_UNKNOWN_TAG;
+		}
+		if (len == 0) {
+			reads += (d->kind == KIND_ACTION) ? 0 : 2 + d->size;
+		} else if (d->kind == KIND_ACTION) {
+			return PROTO_BAD_LENGTH;
+		} else if (d->setting == NULL && d->kind != KIND_STATE && d->kind != KIND_STATE_CHUNK) {
+			return PROTO_READ_ONLY;
+		} else if (len != d->size) {
+			return PROTO_BAD_LENGTH;
+		} else if (!tlvValid(d, &request[pos + 2])) {
+			return PROTO_OUT_OF_RANGE;
+		}
+	}
+	*fault = 0;
+	return (4 + reads > PROTO_RESPONSE_MAX) ? PROTO_TOO_LONG : PROTO_OK;
+}
+
+/* A complete frame: runs it and queues the response */
+static void requestRun(void)
+{
+	uint8_t end = requestLen - 2;
+	uint8_t fault;
+	uint8_t status;
+	bool save = false;
+	uint8_t *dst = &response[4];
+
+	if (requestLen < 5 || request[0] != RECORD_TYPE_REQUEST ||
+			crc16(request, end) != (request[end] | (request[end + 1] << 8))) {
+		return;
+	}
+	status = requestCheck(end, &fault);
+
+	if (status == PROTO_OK) {
+		/* the writes, the reads then */
+		for (uint8_t pos = 3; pos < end; pos += 2 + request[pos + 1]) {
+			if (request[pos + 1] > 0) {
+				tlvWrite(tlvFind(request[pos]), &request[pos + 2]);
+			}
+		}
+		for (uint8_t pos = 3; pos < end; pos += 2 + request[pos + 1]) {
+			const tlvDesc_t *d = tlvFind(request[pos]);
+
+			if (d->tag == TAG_SAVE) {
+				save = true;
+			} else if (d->tag == TAG_MEASURE) {
+				bsec_iot_measure();
+			} else if (d->tag == TAG_STATE_EXPORT) {
+				bsec_iot_state_export();
+			} else if (request[pos + 1] == 0) {
+				dst = tlvRead(d, dst);
+			}
+		}
+		if (save && saveConfig(&thConfig) != 0) {
+			status = PROTO_SAVE_FAILED;
+		}
+	} else {
+		*dst++ = fault;
+	}
+
+	response[0] = RECORD_TYPE_RESPONSE;
+	response[1] = request[1];
+	response[2] = request[2];
+	response[3] = status;
+	responseLen = dst - response;
+	protoFlush();
+}
+
+/* Main loop: queues the pending response, if the vendor TX queue has room for it */
+void protoFlush(void)
+{
+	uint8_t *frame;
+
+	if (responseLen == 0) {
+		return;
+	}
+	/* CRC, COBS overhead and delimiter */
+	frame = VND_TxReserve_FS(responseLen + 4);
+	if (frame != NULL) {
+		VND_TxCommit_FS(binaryFrame(response, responseLen, frame));
+		responseLen = 0;
+	}
+}
+
+/* Request frame byte from the vendor OUT endpoint. false: not taken, a response is still waiting
+   for room in the TX queue, the byte is to be offered again after protoFlush() */
+bool protoPut(uint8_t byte)
+{
+	if (responseLen > 0) {
+		return false;
+	}
+	if (!started) {
+		if (byte != 0x00) {
+			/* COBS code byte of a new frame */
+			started = true;
+			dropped = false;
+			requestLen = 0;
+			left = byte - 1;
+			zeroNext = (byte != 0xFF);
+		}
+		return true;
+	}
+	if (byte == 0x00) {
+		/* delimiter */
+		started = false;
+		if (!dropped && left == 0) {
+			requestRun();
+		}
+		return true;
+	}
+	if (dropped) {
+		return true;
+	}
+	if (left == 0) {
+		/* next block */
+		if (zeroNext) {
+			if (requestLen == PROTO_REQUEST_MAX) {
+				dropped = true;
+				return true;
+			}
+			request[requestLen++] = 0x00;
+		}
+		left = byte - 1;
+		zeroNext = (byte != 0xFF);
+		return true;
+	}
+	if (requestLen == PROTO_REQUEST_MAX) {
+		dropped = true;
+		return true;
+	}
+	request[requestLen++] = byte;
+	left--;
+	return true;
+}
+
+/* No frame started: the next byte can be a JSON object */
+bool protoIdle(void)
+{
+	return !started;
+}
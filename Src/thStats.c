@@ -0,0 +1,99 @@
+/***************************************************************************
+*** MIT License ***
+*
+*** Copyright (c) 2020 Daniel Mancuso - OhmTech.io **
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+#include <stdint.h>
+#include "main.h"
+#include "thStats.h"
+
+/* Current reporting window. The main loop adds to a copy and commits it with the interrupts
+   off, so the TIM2 interrupt always sees a complete window */
+static stats_t window;
+static volatile bool windowClosed = true;
+static uint32_t windowSeq = 0;
+
+/* Main loop: adds a sample to the current window (Welford's online mean and variance),
+   or starts a new window with it if the last one has been reported */
+void statsAdd(const sample_t *sample)
+{
+	stats_t next;
+	bool closed;
+	bool committed;
+
+	do {
+		closed = windowClosed || window.fieldMask != sample->fieldMask;
+		if (closed) {
+			next.seq = windowSeq + 1;
+			next.from = sample->timestamp;
+			next.count = 0;
+			next.fieldMask = sample->fieldMask;
+		} else {
+			next = window;
+		}
+		next.to = sample->timestamp;
+		next.count++;
+
+		for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+			float value = sample->value[i];
+
+			if (closed) {
+				next.min[i] = value;
+				next.max[i] = value;
+				next.mean[i] = value;
+				next.m2[i] = 0.0f;
+			} else {
+				float delta = value - next.mean[i];
+
+				next.mean[i] += delta / next.count;
+				next.m2[i] += delta * (value - next.mean[i]);
+				if (value < next.min[i]) {
+					next.min[i] = value;
+				}
+				if (value > next.max[i]) {
+					next.max[i] = value;
+				}
+			}
+			next.last[i] = value;
+		}
+
+		/* redo it if the window got reported meanwhile */
+		__disable_irq();
+		committed = closed || !windowClosed;
+		if (committed) {
+			window = next;
+			windowSeq = next.seq;
+			windowClosed = false;
+		}
+		__enable_irq();
+	} while (!committed);
+}
+
+/* Reporter side (interrupt context): ends the current window, NULL if it has no samples.
+   The pointer is only valid until the caller returns */
+const stats_t *statsClose(void)
+{
+	if (windowClosed) {
+		return NULL;
+	}
+	windowClosed = true;
+	return &window;
+}
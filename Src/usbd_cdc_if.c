@@ -51,7 +51,10 @@
 #include "usbd_cdc_if.h"
 
 /* USER CODE BEGIN INCLUDE */
+#include <string.h>
 #include "thConfig.h"
+#include "thHid.h"
+#include "thMsc.h"
 /* USER CODE END INCLUDE */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -78,6 +81,36 @@
   */
 
 /* USER CODE BEGIN PRIVATE_TYPES */
+/* TX queue of an IN endpoint, a ring of contiguous blocks (bip buffer): TxRingReserve() hands
+   out space at head, or at the start of the buffer when it doesn't fit before the end. The
+   endpoint sends from tail, sending bytes from tail are in flight. When the data has wrapped,
+   end marks where it stops at the top of the buffer */
+typedef struct {
+  uint8_t *buf;
+  uint16_t size;                /* power of 2 */
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  uint16_t end;
+  uint16_t sending;
+  uint8_t ep;                   /* CDC_IN_EP or VND_IN_EP */
+  /* pending reservation, filled with the interrupts on. Set until it's committed or aborted */
+  uint16_t reserved;
+  volatile uint8_t claimed;
+} txRing_t;
+
+/* OUT data waiting for the main loop (processCommands()). The ISR moves head, the main
+   loop tail, both free running. The OUT endpoint is only re-armed while another packet
+   fits: with the ring full the host gets NAKs until CDC_RxRead_FS() makes room.
+   The transfer ends (short packets) are kept aside, a bit per byte, not in the data */
+typedef struct {
+  uint8_t *buf;
+  uint16_t size;                /* power of 2 */
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  volatile uint8_t paused;      /* OUT endpoint not armed */
+  uint8_t *ends;                /* size / 8: a transfer ends with this byte */
+  volatile uint8_t endPending;  /* a transfer ended with a byte already read */
+} rxRing_t;
 
 /* USER CODE END PRIVATE_TYPES */
 
@@ -94,9 +127,12 @@
 /* Define size for the receive and transmit buffer over CDC */
 /* It's up to user to redefine and/or remove those define */
 #define APP_RX_DATA_SIZE  100
-#define APP_TX_DATA_SIZE  100
-
-extern shellBuffer_t shellBuffer;
+/* RX ring, the shell parses the commands as they come (thConfig.c) */
+#define APP_RX_RING_SIZE  256
+/* TX ring, the serializers render straight into it (largest record: 1 KB) */
+#define APP_TX_DATA_SIZE  2048
+/* Vendor interface TX ring: binary records and framed command replies (up to ~520 bytes) */
+#define VND_TX_DATA_SIZE  1024
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -129,6 +165,24 @@ uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+/* Vendor interface buffers */
+static uint8_t VndRxBufferFS[VND_DATA_FS_MAX_PACKET_SIZE];
+/* a packet is waiting in VndRxBufferFS, the endpoint NAKs until VND_RxResume_FS() */
+static volatile uint8_t vndRxPending = 0;
+static volatile uint16_t vndRxLen;
+static uint8_t VndTxBufferFS[VND_TX_DATA_SIZE];
+
+static uint8_t UserRxRingFS[APP_RX_RING_SIZE];
+static uint8_t UserRxEndsFS[APP_RX_RING_SIZE / 8];
+
+/* set up by CDC_Init_FS() */
+static rxRing_t cdcRx = { UserRxRingFS, APP_RX_RING_SIZE, 0, 0, 0, UserRxEndsFS, 0 };
+
+/* The VCP is open on the host: DTR set, or data received from a terminal that
+   doesn't drive DTR. Cleared by DTR going low and by a USB reset */
+static volatile uint8_t cdcHostOpen = 0;
+static txRing_t cdcTx;
+static txRing_t vndTx;
 
 /* USER CODE END PRIVATE_VARIABLES */
 
@@ -160,8 +214,18 @@ static int8_t CDC_Init_FS(void);
 static int8_t CDC_DeInit_FS(void);
 static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
+static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
+static int8_t VND_Receive_FS(uint8_t* pbuf, uint32_t *Len);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static void TxRingInit(txRing_t *ring, uint8_t *buf, uint16_t size, uint8_t ep);
+static uint8_t *TxRingReserve(txRing_t *ring, uint16_t Len);
+static void TxRingCommit(txRing_t *ring, uint16_t Len);
+static void TxRingKick(txRing_t *ring);
+static void TxRingDone(txRing_t *ring);
+static uint16_t RxRingRoom(rxRing_t *ring);
+static void RxRingPut(rxRing_t *ring, const uint8_t *Buf, uint32_t Len);
+static void RxRingMarkEnd(rxRing_t *ring);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -174,7 +238,15 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS =
   CDC_Init_FS,
   CDC_DeInit_FS,
   CDC_Control_FS,
-  CDC_Receive_FS
+  CDC_Receive_FS,
+  CDC_TransmitCplt_FS,
+  VND_Receive_FS,
+  hidReportDescriptor,
+  hidGetReport,
+  hidSetReport,
+  mscReset,
+  mscReceive,
+  mscClearHalt
 };
 
 USBD_CDC_LineCodingTypeDef linecoding =
@@ -195,8 +267,15 @@ static int8_t CDC_Init_FS(void)
 {
   /* USER CODE BEGIN 3 */
   /* Set Application Buffers */
+  TxRingInit(&cdcTx, UserTxBufferFS, APP_TX_DATA_SIZE, CDC_IN_EP);
+  TxRingInit(&vndTx, VndTxBufferFS, VND_TX_DATA_SIZE, VND_IN_EP);
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  USBD_CDC_SetVendorTxBuffer(&hUsbDeviceFS, VndTxBufferFS, 0);
+  USBD_CDC_SetVendorRxBuffer(&hUsbDeviceFS, VndRxBufferFS);
+  /* the class arms the OUT endpoint, what's queued stays for the main loop */
+  cdcRx.paused = 0;
+  cdcHostOpen = 0;
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -208,6 +287,7 @@ static int8_t CDC_Init_FS(void)
 static int8_t CDC_DeInit_FS(void)
 {
   /* USER CODE BEGIN 4 */
+  cdcHostOpen = 0;
   return (USBD_OK);
   /* USER CODE END 4 */
 }
@@ -282,7 +362,8 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
     break;
 
     case CDC_SET_CONTROL_LINE_STATE:
-
+      /* no data stage, pbuf is the request. wValue bit 0: DTR, the port is open */
+      cdcHostOpen = (((USBD_SetupReqTypedef *)pbuf)->wValue & 0x01) != 0;
     break;
 
     case CDC_SEND_BREAK:
@@ -314,53 +395,24 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  if (shellBuffer.newLine){
-    processVCPinput(); //<1us
-    /* Buffer wasn't processed yet. We are not ready for new packages */
-    return (USBD_BUSY);
-  } else {
-    if (*Len == 1){
-      /* User is using a terminal (1 character per OUT transaction) */
-      uint8_t rxChar = Buf[0];
-
-      if (rxChar == '\n' || rxChar == '\r'){
-        /* Some consoles send \r on ENTER, so let's take it as a line feed too */
-         shellBuffer.Buf[shellBuffer.idx++] = '\n';
-         shellBuffer.newLine = true;
-      } else if (rxChar == 127 || rxChar == 8){ /* DEL or BackSpace */
-        shellBuffer.idx--;
-      } else {
-        /* We just assume it's a printable character... */
-        shellBuffer.Buf[shellBuffer.idx++] = rxChar;
-      }
-    } else {
-      /* User is using directly the character device (cat or library), 
-        an entire string arrives, but as the max. bulk lenght is 64 bytes,
-        the string can be split in several pagages.. */
-
-      /* avoid a buffer overflow */
-      if ((shellBuffer.idx + *Len) >= SHELL_BUFFER_LENGTH) {
-        /* too long to process, reset the buffer*/
-        shellBuffer.idx = 0;
-      } else {
-        memcpy(shellBuffer.Buf + shellBuffer.idx, Buf, *Len);  
-        shellBuffer.idx += *Len;
-
-        if (*Len < 64){
-          shellBuffer.newLine = true;
-        }
-      }
-    }
+  /* no parsing here, the commands run in the main loop (processCommands()) */
+  RxRingPut(&cdcRx, Buf, *Len);
+  cdcHostOpen = 1;
+  if (*Len != 1 && *Len < CDC_DATA_FS_OUT_PACKET_SIZE){
+    /* A program (cat or a library) sends the entire string at once: it ends with the
+      transfer, on a short packet (or a zero-length one). A terminal sends 1 character
+      per OUT transaction, the line ends on ENTER. The shell decides what the end means */
+    RxRingMarkEnd(&cdcRx);
+  }
 
+  if (RxRingRoom(&cdcRx) > CDC_DATA_FS_OUT_PACKET_SIZE){
     /* Prepare for the next reception */
-    USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
     USBD_CDC_ReceivePacket(&hUsbDeviceFS);
-
-    processVCPinput(); //<1us
-    return (USBD_OK);
+  } else {
+    /* NAK the host until the main loop catches up */
+    cdcRx.paused = 1;
   }
-
-   
+  return (USBD_OK);
   /* USER CODE END 6 */
 }
 
@@ -379,17 +431,450 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
 {
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
-  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
-  if (hcdc->TxState != 0){
-    return USBD_BUSY;
+  /* Copied to the TX queue, whole or not at all (USBD_BUSY if it doesn't fit) */
+  uint8_t *dst = CDC_TxReserve_FS(Len);
+
+  if (dst == NULL){
+    return (hUsbDeviceFS.pClassData == NULL) ? USBD_FAIL : USBD_BUSY;
   }
-  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, Buf, Len);
-  result = USBD_CDC_TransmitPacket(&hUsbDeviceFS);
+  memcpy(dst, Buf, Len);
+  CDC_TxCommit_FS(Len);
   /* USER CODE END 7 */
   return result;
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  CDC_TxReserve_FS
+  *         Reserves Len contiguous bytes of the TX queue, to be filled in place
+  *         and then passed to CDC_TxCommit_FS() (or dropped with CDC_TxAbort_FS()).
+  *         Callable from any context. One reservation at a time: until the
+  *         commit/abort, other callers (an interrupt preempting the render) get NULL.
+  * @param  Len: Upper bound of the data to be sent (in bytes)
+  * @retval Where to write, NULL if the queue is full or the device isn't configured
+  */
+uint8_t *CDC_TxReserve_FS(uint16_t Len)
+{
+  return TxRingReserve(&cdcTx, Len);
+}
+
+/**
+  * @brief  CDC_TxCommit_FS
+  *         Queues the first Len bytes of the reservation and starts sending them
+  * @param  Len: Number of data to be sent (in bytes), up to the reserved size
+  * @retval None
+  */
+void CDC_TxCommit_FS(uint16_t Len)
+{
+  TxRingCommit(&cdcTx, Len);
+}
+
+/**
+  * @brief  CDC_TxAbort_FS
+  *         Drops the reservation, nothing is queued
+  * @retval None
+  */
+void CDC_TxAbort_FS(void)
+{
+  cdcTx.claimed = 0;
+}
+
+/**
+  * @brief  VND_TxReserve_FS
+  *         CDC_TxReserve_FS() for the vendor interface IN endpoint
+  * @param  Len: Upper bound of the data to be sent (in bytes)
+  * @retval Where to write, NULL if the queue is full or the device isn't configured
+  */
+uint8_t *VND_TxReserve_FS(uint16_t Len)
+{
+  return TxRingReserve(&vndTx, Len);
+}
+
+/**
+  * @brief  VND_TxCommit_FS
+  *         CDC_TxCommit_FS() for the vendor interface IN endpoint
+  * @param  Len: Number of data to be sent (in bytes), up to the reserved size
+  * @retval None
+  */
+void VND_TxCommit_FS(uint16_t Len)
+{
+  TxRingCommit(&vndTx, Len);
+}
+
+/**
+  * @brief  VND_TxAbort_FS
+  *         CDC_TxAbort_FS() for the vendor interface IN endpoint
+  * @retval None
+  */
+void VND_TxAbort_FS(void)
+{
+  vndTx.claimed = 0;
+}
+
+/**
+  * @brief  HID_SendReport_FS
+  *         Sends an input report on the HID interface, hidReportSent() is
+  *         called when it's gone. Called from the timer and USB ISRs only.
+  * @param  Report: report, ID first, kept until it's sent
+  * @param  Len: report length
+  * @retval USBD_OK, USBD_BUSY while a report is pending, USBD_FAIL if not configured
+  */
+uint8_t HID_SendReport_FS(uint8_t *Report, uint16_t Len)
+{
+  return USBD_CDC_HidSendReport(&hUsbDeviceFS, Report, Len);
+}
+
+/**
+  * @brief  MSC_Transmit_FS
+  *         Starts a transfer on the MSC IN endpoint, mscDataSent() is called
+  *         when it's done.
+  * @param  Buf: data, kept until it's sent
+  * @param  Len: data length
+  * @retval USBD_OK, USBD_FAIL if not configured
+  */
+uint8_t MSC_Transmit_FS(uint8_t *Buf, uint16_t Len)
+{
+  return USBD_CDC_MscTransmit(&hUsbDeviceFS, Buf, Len);
+}
+
+/**
+  * @brief  MSC_Receive_FS
+  *         Arms the MSC OUT endpoint, mscReceive() is called with the transfer.
+  * @param  Buf: destination buffer
+  * @param  Len: buffer size
+  * @retval USBD_OK, USBD_FAIL if not configured
+  */
+uint8_t MSC_Receive_FS(uint8_t *Buf, uint16_t Len)
+{
+  return USBD_CDC_MscPrepareReceive(&hUsbDeviceFS, Buf, Len);
+}
+
+/**
+  * @brief  MSC_Stall_FS
+  *         Halts an MSC endpoint until the host clears it, see mscClearHalt().
+  * @param  Ep: MSC_IN_EP or MSC_OUT_EP
+  * @retval None
+  */
+void MSC_Stall_FS(uint8_t Ep)
+{
+  USBD_CDC_MscStall(&hUsbDeviceFS, Ep);
+}
+
+/**
+  * @brief  VND_Receive_FS
+  *         Data received on the vendor OUT endpoint. The packet stays in
+  *         VndRxBufferFS, and the endpoint NAKs, until the main loop has parsed
+  *         it, see VND_RxPacket_FS(). The replies go out on the vendor IN endpoint.
+  * @param  Buf: Buffer of data received
+  * @param  Len: Number of data received (in bytes)
+  * @retval USBD_OK
+  */
+static int8_t VND_Receive_FS(uint8_t* Buf, uint32_t *Len)
+{
+  if (vndRxPending){
+    /* a USB reset re-armed the endpoint, the main loop resumes it once done */
+    return (USBD_OK);
+  }
+  vndRxLen = *Len;
+  vndRxPending = 1;
+  return (USBD_OK);
+}
+
+/**
+  * @brief  VND_RxPacket_FS
+  *         Main loop: the packet received on the vendor OUT endpoint, if any.
+  *         It's valid until VND_RxResume_FS().
+  * @param  Len: its length, 0 for a zero-length packet
+  * @retval the packet, NULL if none
+  */
+const uint8_t *VND_RxPacket_FS(uint16_t *Len)
+{
+  if (!vndRxPending){
+    return NULL;
+  }
+  *Len = vndRxLen;
+  return VndRxBufferFS;
+}
+
+/**
+  * @brief  VND_RxResume_FS
+  *         Main loop: the vendor packet is parsed, receive the next one.
+  * @retval None
+  */
+void VND_RxResume_FS(void)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  vndRxPending = 0;
+  USBD_CDC_VendorReceivePacket(&hUsbDeviceFS);
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief  CDC_HostListening_FS
+  *         Someone reads the VCP: the port is open and the bus isn't suspended.
+  *         Nothing else is worth serializing for it.
+  * @retval 1 if listening, 0 otherwise
+  */
+uint8_t CDC_HostListening_FS(void)
+{
+  return cdcHostOpen && (hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED);
+}
+
+/**
+  * @brief  CDC_RxRead_FS
+  *         Main loop: takes up to Len bytes received on the CDC data interface,
+  *         re-arms the OUT endpoint once a packet fits again. Stops after the
+  *         last byte of a transfer.
+  * @param  Buf: destination
+  * @param  Len: destination size
+  * @param  End: set if a transfer ended with the bytes copied (or before them, none copied)
+  * @retval Number of bytes copied
+  */
+uint16_t CDC_RxRead_FS(uint8_t *Buf, uint16_t Len, uint8_t *End)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint16_t tail;
+  uint16_t count;
+  uint16_t i;
+
+  *End = 0;
+  /* the ISR marks the unread bytes only, the marks move with the tail */
+  __disable_irq();
+  if (cdcRx.endPending){
+    cdcRx.endPending = 0;
+    *End = 1;
+    __set_PRIMASK(primask);
+    return 0;
+  }
+  tail = cdcRx.tail;
+  count = cdcRx.head - tail;
+  if (count > Len){
+    count = Len;
+  }
+  for (i = 0; i < count && !*End; i++){
+    uint16_t pos = (tail + i) & (cdcRx.size - 1);
+    uint8_t bit = 1 << (pos & 7);
+
+    Buf[i] = cdcRx.buf[pos];
+    if (cdcRx.ends[pos >> 3] & bit){
+      cdcRx.ends[pos >> 3] &= ~bit;
+      *End = 1;
+    }
+  }
+  cdcRx.tail = tail + i;
+
+  if (cdcRx.paused && RxRingRoom(&cdcRx) > CDC_DATA_FS_OUT_PACKET_SIZE){
+    cdcRx.paused = 0;
+    USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  }
+  __set_PRIMASK(primask);
+  return i;
+}
+
+/**
+  * @brief  TxRingInit
+  *         Empties a TX queue, USB (re)configuration
+  * @retval None
+  */
+static void TxRingInit(txRing_t *ring, uint8_t *buf, uint16_t size, uint8_t ep)
+{
+  ring->buf = buf;
+  ring->size = size;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->end = size;
+  ring->sending = 0;
+  ring->ep = ep;
+  /* a reservation from before the reset is dropped by its commit */
+  ring->claimed = 0;
+}
+
+/**
+  * @brief  TxRingReserve
+  *         See CDC_TxReserve_FS()
+  * @retval Where to write, NULL if the queue is full or the device isn't configured
+  */
+static uint8_t *TxRingReserve(txRing_t *ring, uint16_t Len)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint16_t head, tail;
+
+  __disable_irq();
+  if (hUsbDeviceFS.pClassData == NULL || ring->claimed){
+    __set_PRIMASK(primask);
+    return NULL;
+  }
+  head = ring->head;
+  tail = ring->tail;
+  if (head == tail){
+    /* empty (nothing in flight either): start over from the beginning */
+    head = tail = ring->head = ring->tail = 0;
+    ring->end = ring->size;
+  }
+
+  /* one byte stays unused, head == tail means empty */
+  if (tail <= head && ring->size - head - (tail == 0) >= Len){
+    ring->reserved = head;
+  } else if (tail <= head && tail > Len){
+    ring->reserved = 0;
+  } else if (tail > head && tail - head - 1 >= Len){
+    ring->reserved = head;
+  } else {
+    __set_PRIMASK(primask);
+    return NULL;
+  }
+  /* the interrupts only free space meanwhile (TxRingDone()) */
+  ring->claimed = 1;
+  __set_PRIMASK(primask);
+  return &ring->buf[ring->reserved];
+}
+
+/**
+  * @brief  TxRingCommit
+  *         See CDC_TxCommit_FS()
+  * @retval None
+  */
+static void TxRingCommit(txRing_t *ring, uint16_t Len)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  if (Len > 0 && ring->claimed){
+    if (ring->reserved != ring->head){
+      if (ring->tail == ring->head){
+        /* everything before was sent during the render, the data starts over from the beginning */
+        ring->tail = 0;
+      } else {
+        /* wrapped, the data at the top stops here */
+        ring->end = ring->head;
+      }
+    }
+    ring->head = (ring->reserved + Len) & (ring->size - 1);
+    TxRingKick(ring);
+  }
+  ring->claimed = 0;
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief  TxRingKick
+  *         Starts the next transfer if the IN endpoint is idle: the queue contents
+  *         up to head or end, the USB stack splits it in 64 byte packets.
+  *         Interrupts off, or from the USB interrupt.
+  * @retval None
+  */
+static void TxRingKick(txRing_t *ring)
+{
+  uint16_t head = ring->head;
+  uint16_t tail = ring->tail;
+
+  if (hUsbDeviceFS.pClassData == NULL || ring->sending != 0 || head == tail){
+    return;
+  }
+  ring->sending = (head > tail) ? head - tail : ring->end - tail;
+  if (ring->ep == VND_IN_EP){
+    USBD_CDC_SetVendorTxBuffer(&hUsbDeviceFS, &ring->buf[tail], ring->sending);
+    USBD_CDC_VendorTransmitPacket(&hUsbDeviceFS);
+  } else {
+    USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &ring->buf[tail], ring->sending);
+    USBD_CDC_TransmitPacket(&hUsbDeviceFS);
+  }
+}
+
+/**
+  * @brief  TxRingDone
+  *         The transfer started by TxRingKick() is done: frees its bytes and
+  *         sends what was queued meanwhile.
+  * @retval None
+  */
+static void TxRingDone(txRing_t *ring)
+{
+  uint16_t tail = ring->tail + ring->sending;
+
+  if (tail >= ring->end){
+    /* the top of the buffer is done, the data goes on from the start */
+    tail = 0;
+    ring->end = ring->size;
+  }
+  ring->tail = tail;
+  ring->sending = 0;
+  TxRingKick(ring);
+}
+
+/**
+  * @brief  RxRingRoom
+  * @retval Free bytes in the RX ring
+  */
+static uint16_t RxRingRoom(rxRing_t *ring)
+{
+  return ring->size - (uint16_t)(ring->head - ring->tail);
+}
+
+/**
+  * @brief  RxRingPut
+  *         USB interrupt: queues received bytes. The endpoint is only armed
+  *         while a packet fits, nothing is dropped but after a USB reset.
+  * @retval None
+  */
+static void RxRingPut(rxRing_t *ring, const uint8_t *Buf, uint32_t Len)
+{
+  uint16_t head = ring->head;
+  uint16_t room = RxRingRoom(ring);
+
+  if (Len > room){
+    Len = room;
+  }
+  for (uint16_t i = 0; i < Len; i++){
+    ring->buf[(head + i) & (ring->size - 1)] = Buf[i];
+  }
+  /* the data before the index */
+  __DMB();
+  ring->head = head + Len;
+}
+
+/**
+  * @brief  RxRingMarkEnd
+  *         USB interrupt: a transfer ends with the last byte queued.
+  * @retval None
+  */
+static void RxRingMarkEnd(rxRing_t *ring)
+{
+  uint16_t last = (ring->head - 1) & (ring->size - 1);
+
+  if (ring->head == ring->tail){
+    /* nothing unread (zero-length packet), the next read reports it */
+    ring->endPending = 1;
+  } else {
+    ring->ends[last >> 3] |= 1 << (last & 7);
+  }
+}
+
+/**
+  * @brief  CDC_TransmitCplt_FS
+  *         A transfer on the CDC data, the vendor, the HID or the MSC IN
+  *         endpoint is done (zero-length packet included).
+  * @param  Buf: Buffer of data that was sent
+  * @param  Len: Number of data sent (in bytes)
+  * @param  epnum: IN endpoint
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
+{
+  if (epnum == (HID_IN_EP & 0x7F))
+  {
+    hidReportSent();
+    return (USBD_OK);
+  }
+  if (epnum == (MSC_IN_EP & 0x7F))
+  {
+    mscDataSent();
+    return (USBD_OK);
+  }
+  TxRingDone((epnum == (VND_IN_EP & 0x7F)) ? &vndTx : &cdcTx);
+  return (USBD_OK);
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
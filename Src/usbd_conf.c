@@ -71,7 +71,8 @@ PCD_HandleTypeDef hpcd_USB_FS;
 void Error_Handler(void);
 
 /* USER CODE BEGIN 0 */
-
+#include "thPower.h"
+#include "thClock.h"
 /* USER CODE END 0 */
 
 /* USER CODE BEGIN PFP */
@@ -106,6 +107,8 @@ void HAL_PCD_MspInit(PCD_HandleTypeDef* pcdHandle)
     HAL_NVIC_SetPriority(USB_IRQn, 0, 0);
     HAL_NVIC_EnableIRQ(USB_IRQn);
   /* USER CODE BEGIN USB_MspInit 1 */
+    /* the resume wakes the MCU up from STOP mode (thPower.c) */
+    __HAL_USB_WAKEUP_EXTI_ENABLE_IT();
 
   /* USER CODE END USB_MspInit 1 */
   }
@@ -169,6 +172,8 @@ void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
   */
 void HAL_PCD_SOFCallback(PCD_HandleTypeDef *hpcd)
 {
+  /* host time reference, first thing */
+  clockSof();
   USBD_LL_SOF((USBD_HandleTypeDef*)hpcd->pData);
 }
 
@@ -210,6 +215,8 @@ void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd)
   USBD_LL_Suspend((USBD_HandleTypeDef*)hpcd->pData);
   /* Enter in STOP mode. */
   /* USER CODE BEGIN 2 */
+  /* the BSEC loop sleeps in STOP mode between samples from now on, see powerSleep() */
+  powerSuspend();
   if (hpcd->Init.low_power_enable)
   {
     /* Set SLEEPDEEP bit and SleepOnExit of Cortex System Control Register. */
@@ -233,6 +240,10 @@ void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd)
     SCB->SCR &= (uint32_t)~((uint32_t)(SCB_SCR_SLEEPDEEP_Msk | SCB_SCR_SLEEPONEXIT_Msk));
     SystemClockConfig_Resume();
   }
+  /* back to the HSI48 if woken up from STOP mode */
+  powerResume();
+  /* the PCD wakeup handler leaves the SOF interrupt out of the mask */
+  hpcd->Instance->CNTR |= USB_CNTR_SOFM;
   /* USER CODE END 3 */
   USBD_LL_Resume((USBD_HandleTypeDef*)hpcd->pData);
 }
@@ -308,11 +319,19 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
     Error_Handler( );
   }
 
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x00 , PCD_SNG_BUF, 0x18);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x80 , PCD_SNG_BUF, 0x58);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x81 , PCD_SNG_BUF, 0xC0);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x01 , PCD_SNG_BUF, 0x110);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x82 , PCD_SNG_BUF, 0x100);
+  /* BTABLE takes 0x00-0x37 (EP0..EP6). The data IN endpoint is double buffered,
+     buffer 0 at 0xC0 and buffer 1 at 0x100, so it needs both EP1 descriptors
+     and the data OUT endpoint moves to EP3. EP4 is the vendor interface, EP5 HID, EP6 MSC */
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x00 , PCD_SNG_BUF, 0x40);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x80 , PCD_SNG_BUF, 0x80);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , CDC_IN_EP , PCD_DBL_BUF, 0x010000C0);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , CDC_OUT_EP , PCD_SNG_BUF, 0x140);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , CDC_CMD_EP , PCD_SNG_BUF, 0x180);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , VND_OUT_EP , PCD_SNG_BUF, 0x188);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , VND_IN_EP , PCD_SNG_BUF, 0x1C8);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , HID_IN_EP , PCD_SNG_BUF, 0x208);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , MSC_OUT_EP , PCD_SNG_BUF, 0x218);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , MSC_IN_EP , PCD_SNG_BUF, 0x258);
   return USBD_OK;
 }
 
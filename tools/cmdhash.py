@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""Generates Inc/thCommands.h, the JSON shell commands of Src/thConfig.c in a perfect hash table.
+
+Every key gets a slot of its own: a lookup is one hash over the key and one compare,
+however many commands there are. To add one, list it in COMMANDS, write its handler
+(cmd + the key, capitalized) in thConfig.c and run, from the repository root:
+
+    python3 tools/cmdhash.py
+
+With --bench it writes nothing: it times the table against the strcmp() chain it replaced,
+on the host (cc), over every key and as many unknown ones.
+"""
+import os
+import subprocess
+import sys
+import tempfile
+
+# key, value type, action: the value is converted (and checked) before the handler runs,
+# VALUE_NONE doesn't need one, VALUE_ANY gets the token as it is. A setting's handler runs
+# on the member, into the object's copy of thConfig; an action's once the object is closed
+COMMANDS = [
+    ("status",            "VALUE_NONE",  True),
+    ("info",              "VALUE_NONE",  True),
+    ("replay",            "VALUE_UINT",  True),
+    ("logDump",           "VALUE_UINT",  True),
+    ("led",               "VALUE_BOOL",  False),
+    ("format",            "VALUE_ANY",   False),
+    ("fields",            "VALUE_ANY",   False),
+    ("reportingPeriod",   "VALUE_UINT",  False),
+    ("temperatureOffset", "VALUE_FLOAT", False),
+    ("report",            "VALUE_ANY",   False),
+    ("deadband",          "VALUE_ANY",   False),
+    ("statsLast",         "VALUE_BOOL",  False),
+    ("logPeriod",         "VALUE_UINT",  False),
+    ("catchUp",           "VALUE_BOOL",  False),
+    ("hidInterval",       "VALUE_UINT",  False),
+    ("hidSize",           "VALUE_UINT",  False),
+    ("sampleRate",        "VALUE_ANY",   False),
+    ("measure",           "VALUE_NONE",  True),
+    ("saveConfig",        "VALUE_NONE",  False),
+]
+
+OUTPUT = "Inc/thCommands.h"
+
+TYPES = """typedef enum {
+	VALUE_NONE,		/* no value needed, the key is the command */
+	VALUE_ANY,		/* the handler reads the token */
+	VALUE_BOOL,		/* true or false */
+	VALUE_UINT,		/* decimal, unsigned */
+	VALUE_FLOAT,
+} valueType_t;
+
+typedef struct {
+	const char *json;
+	const jsmntok_t *tok;	/* NULL for a key alone, {"status"}: VALUE_NONE only */
+	union {
+		uint32_t u;
+		float f;
+		bool b;
+	};
+} cmdValue_t;
+
+/* What's next for the object, once the handler is done */
+typedef enum {
+	CMD_NEXT,		/* on with the other keys */
+	CMD_DONE,		/* the reply is sent: no status reply, the other actions are skipped */
+	CMD_SAVE,		/* store thConfig in flash when the object is closed */
+} cmdResult_t;
+
+typedef cmdResult_t (*cmdHandler_t)(const cmdValue_t *value);
+
+typedef struct {
+	const char *key;	/* NULL: free slot */
+	uint8_t len;
+	valueType_t type;
+	bool action;		/* run once the object is closed without error, the settings in place */
+	cmdHandler_t handler;
+} command_t;
+"""
+FNV_PRIME = 16777619
+
+
+def fnv1a(seed, key):
+    """Same as commandFind() in thConfig.c"""
+    h = seed
+    for c in key.encode():
+        h = ((h ^ c) * FNV_PRIME) & 0xFFFFFFFF
+    return h
+
+
+def slot_of(h, size):
+    """The top bits, the low ones only depend on the low bits of the seed and the characters"""
+    return h >> (32 - size.bit_length() + 1)
+
+
+def search(keys):
+    """Smallest power of 2 table, at least twice the keys, with a seed that spreads them all"""
+    size = 1
+    while size < 2 * len(keys):
+        size *= 2
+    while True:
+        for seed in range(1, 1 << 16):
+            if len({slot_of(fnv1a(seed, k), size) for k in keys}) == len(keys):
+                return seed, size
+        size *= 2
+
+
+def handler(key):
+    return "cmd" + key[0].upper() + key[1:]
+
+
+BENCH = r"""
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 200000
+
+static const char *const chain[] = { %(chain)s };
+static const struct { const char *key; uint8_t len; } table[%(size)d] = { %(table)s };
+static const char *const keys[] = { %(keys)s };
+
+/* the old processJson(): jsoneq() on every key in turn */
+static int chainFind(const char *key, int len)
+{
+	for (unsigned n = 0; n < sizeof(chain) / sizeof(chain[0]); n++) {
+		if ((int)strlen(chain[n]) == len && strncmp(key, chain[n], len) == 0) {
+			return n;
+		}
+	}
+	return -1;
+}
+
+/* commandFind() */
+static int tableFind(const char *key, int len)
+{
+	uint32_t h = %(seed)dUL;
+
+	for (int n = 0; n < len; n++) {
+		h = (h ^ (uint8_t)key[n]) * 16777619UL;
+	}
+	h >>= %(shift)d;
+	if (table[h].key == NULL || table[h].len != len || memcmp(table[h].key, key, len) != 0) {
+		return -1;
+	}
+	return h;
+}
+
+static double bench(int (*find)(const char *, int), const int *lens)
+{
+	struct timespec t0, t1;
+	volatile int sink = 0;
+	unsigned count = sizeof(keys) / sizeof(keys[0]);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int r = 0; r < ROUNDS; r++) {
+		for (unsigned n = 0; n < count; n++) {
+			sink += find(keys[n], lens[n]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / ((double)ROUNDS * count);
+}
+
+int main(void)
+{
+	unsigned count = sizeof(keys) / sizeof(keys[0]);
+	int lens[sizeof(keys) / sizeof(keys[0])];
+
+	for (unsigned n = 0; n < count; n++) {
+		lens[n] = strlen(keys[n]);
+		if ((chainFind(keys[n], lens[n]) < 0) != (tableFind(keys[n], lens[n]) < 0)) {
+			printf("mismatch on %%s\n", keys[n]);
+			return 1;
+		}
+	}
+	double chainNs = bench(chainFind, lens);
+	double tableNs = bench(tableFind, lens);
+	printf("%%u lookups: strcmp chain %%.1f ns, hash table %%.1f ns (%%.1fx)\n",
+			count, chainNs, tableNs, chainNs / tableNs);
+	return 0;
+}
+"""
+
+
+def bench(keys, seed, size):
+    """Host timing of commandFind() against the strcmp() chain, the keys found and not"""
+    table = ["[%d] = { \"%s\", %d }" % (slot_of(fnv1a(seed, k), size), k, len(k)) for k in keys]
+    unknown = [k[:-1] + "_" for k in keys]
+    source = BENCH % {
+        "chain": ", ".join('"%s"' % k for k in keys),
+        "size": size,
+        "table": ", ".join(table),
+        "keys": ", ".join('"%s"' % k for k in keys + unknown),
+        "seed": seed,
+        "shift": 32 - size.bit_length() + 1,
+    }
+    with tempfile.TemporaryDirectory() as tmp:
+        src = os.path.join(tmp, "cmdbench.c")
+        exe = os.path.join(tmp, "cmdbench")
+        with open(src, "w") as f:
+            f.write(source)
+        subprocess.run([os.environ.get("CC", "cc"), "-O2", "-o", exe, src], check=True)
+        subprocess.run([exe], check=True)
+
+
+def main():
+    keys = [k for k, _, _ in COMMANDS]
+    if len(set(keys)) != len(keys):
+        sys.exit("duplicate key")
+    seed, size = search(keys)
+    if "--bench" in sys.argv[1:]:
+        bench(keys, seed, size)
+        return
+    slots = sorted((slot_of(fnv1a(seed, k), size), k, t, a) for k, t, a in COMMANDS)
+    width = max(len(k) for k in keys)
+
+    out = []
+    out.append("/* Generated by tools/cmdhash.py, do not edit: the commands are listed there.")
+    out.append("   Included by thConfig.c only, the handlers are its own */")
+    out.append("#pragma once")
+    out.append("#include <stdint.h>")
+    out.append("#include <stdbool.h>")
+    out.append("#include \"jsonStream.h\"")
+    out.append("")
+    out.append(TYPES)
+    out.append("#define COMMAND_HASH_SEED\t0x%08XUL" % seed)
+    out.append("#define COMMAND_TABLE_SIZE\t%d" % size)
+    out.append("#define COMMAND_HASH_SHIFT\t%d\t/* slot: the top bits of the hash */" % (32 - size.bit_length() + 1))
+    out.append("")
+    for k, _, _ in COMMANDS:
+        out.append("static cmdResult_t %s(const cmdValue_t *value);" % handler(k))
+    out.append("")
+    out.append("static const command_t commandTable[COMMAND_TABLE_SIZE] = {")
+    for slot, k, t, a in slots:
+        quoted = '"%s",' % k
+        out.append("\t[%2d] = { %-*s %2d, %-12s %-6s %s }," % (slot, width + 3, quoted, len(k), t + ",",
+                                                             ("true" if a else "false") + ",", handler(k)))
+    out.append("};")
+
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(out) + "\n")
+    print("%s: %d commands, %d slots, seed 0x%08X" % (OUTPUT, len(keys), size, seed))
+
+
+if __name__ == "__main__":
+    main()